@@ -31,18 +31,37 @@
 #define RVIZ_CAMERA_STREAM_CAMERA_DISPLAY_H
 
 #include <QObject>
+#include <map>
 #include <string>
+#include <vector>
 
 #ifndef Q_MOC_RUN
+#include <OgreAxisAlignedBox.h>
+#include <OgreColourValue.h>
+#include <OgreCommon.h>
 #include <OgreMaterial.h>
+#include <OgreMatrix4.h>
+#include <OgreQuaternion.h>
 #include <OgreRenderTargetListener.h>
 #include <OgreSharedPtr.h>
 #include <OgreTexture.h>
+#include <OgreVector3.h>
 
 # include <sensor_msgs/CameraInfo.h>
+# include <sensor_msgs/Image.h>
 
 # include "rviz/image/image_display_base.h"
+#include <std_srvs/SetBool.h>
 #include <std_srvs/Trigger.h>
+
+#include "rviz_camera_stream/GetFrame.h"
+#include "rviz_camera_stream/depth_lidar.h"
+#include "rviz_camera_stream/frame_cache.h"
+#include "rviz_camera_stream/gstreamer_output.h"
+#include "rviz_camera_stream/latency_probe.h"
+#include "rviz_camera_stream/layer_compositor.h"
+#include "rviz_camera_stream/multicast_image.h"
+#include "rviz_camera_stream/shm_camera_input.h"
 #endif
 
 namespace Ogre
@@ -56,18 +75,22 @@ class Camera;
 namespace video_export
 {
 class  VideoPublisher;
+class  BandwidthController;
 }
 
 namespace rviz
 {
 
+class BoolProperty;
 class EnumProperty;
 class FloatProperty;
 class IntProperty;
 class RenderPanel;
 class RosTopicProperty;
+class DisplayGroup;
 class DisplayGroupVisibilityProperty;
 class ColorProperty;
+class TfFrameProperty;
 
 /**
  * \class CameraPub
@@ -94,6 +117,19 @@ public:
   static const QString OVERLAY;
   static const QString BOTH;
 
+  enum Projection
+  {
+    PROJECTION_PERSPECTIVE = 0,
+    PROJECTION_ORTHOGRAPHIC = 1,
+    PROJECTION_LIDAR = 2
+  };
+
+  enum Input
+  {
+    INPUT_ROS = 0,
+    INPUT_SHARED_MEMORY = 1
+  };
+
 protected:
   // overrides from Display
   virtual void onEnable();
@@ -106,10 +142,23 @@ private Q_SLOTS:
   void updateTopic();
   virtual void updateQueueSize();
   virtual void updateFrameRate();
+  virtual void updateKeyframes();
+  virtual void updateBandwidth();
+  virtual void updateDiagnostics();
+  virtual void updateMulticast();
+  virtual void updateGstreamer();
   virtual void updateBackgroundColor();
   virtual void updateDisplayNamespace();
   virtual void updateImageEncoding();
   virtual void updateNearClipDistance();
+  virtual void updateProjection();
+  virtual void updateLidar();
+  virtual void updateInput();
+  virtual void updateThreadedPublishing();
+  virtual void updateMainView();
+  virtual void updateLatencyProbe();
+  virtual void updateWarmStandby();
+  virtual void updateFrameCache();
 
 private:
   std::string camera_trigger_name_;
@@ -118,14 +167,155 @@ private:
   void subscribe();
   void unsubscribe();
 
+  // disabled without giving up the publishers, camera info and pose, so
+  // enabling again picks up where it left off
+  ros::ServiceServer standby_service_;
+  bool standbyCallback(std_srvs::SetBoolRequest& req, std_srvs::SetBoolResponse& res);
+  bool standby_;
+  bool standby_requested_;
+
+  // recently published frames looked up by stamp
+  ros::ServiceServer get_frame_service_;
+  bool getFrameCallback(rviz_camera_stream::GetFrameRequest& req, rviz_camera_stream::GetFrameResponse& res);
+  rviz_camera_stream::FrameCache frame_cache_;
+
   ros::ServiceServer trigger_service_;
   bool triggerCallback(std_srvs::TriggerRequest& req, std_srvs::TriggerResponse& res);
   bool trigger_activated_;
   ros::Time last_image_publication_time_;
 
+  // stills with the high quality profile on their own topic
+  ros::ServiceServer hq_trigger_service_;
+  bool hqTriggerCallback(std_srvs::TriggerRequest& req, std_srvs::TriggerResponse& res);
+  bool hq_trigger_activated_;
+  void captureHighQuality();
+  Ogre::TexturePtr hq_texture_;
+  std::vector<uint8_t> hq_readback_;
+
+  // frames rendered back to back into memory and published afterwards
+  struct BurstFrame
+  {
+    sensor_msgs::ImagePtr native;
+    sensor_msgs::CameraInfo camera_info;
+    std::string frame_id;
+  };
+  ros::ServiceServer burst_service_;
+  bool burstCallback(std_srvs::TriggerRequest& req, std_srvs::TriggerResponse& res);
+  void updateBurst();
+  std::vector<BurstFrame> burst_frames_;
+  Ogre::PixelFormat burst_pf_;
+  size_t burst_captured_;
+  size_t burst_published_;
+
+  // frame rate, trigger and keyframe gating, decides whether update() renders at all
+  bool isFrameDue(const ros::Time& cur_time);
+  void updateBandwidthStatus();
+  void updateMulticastStatus();
+  void updateRenderStats();
+  void updateLatencyStatus();
+
+  struct RenderStats
+  {
+    RenderStats();
+    void add(const ros::WallDuration& render, size_t triangle_count, size_t batch_count);
+    void addPipeline(const ros::WallDuration& readback, const ros::WallDuration& publish);
+
+    unsigned int frames;
+    size_t triangles;
+    size_t batches;
+    size_t culled;
+    double render_ms;
+    double readback_ms;
+    double publish_ms;
+    unsigned int published;
+  };
+  RenderStats render_stats_;
+  ros::WallTime render_start_;
+  ros::WallTime last_stats_report_;
+  ros::Publisher diagnostics_pub_;
+  rviz_camera_stream::LatencyProbe* latency_probe_;
+  ros::WallTime last_latency_report_;
+  // camera pose of the last published frame
+  Ogre::Vector3 keyframe_position_;
+  Ogre::Quaternion keyframe_orientation_;
+  bool has_keyframe_;
+
   void caminfoCallback(const sensor_msgs::CameraInfo::ConstPtr& msg);
 
   bool updateCamera();
+  void cullDisplays(DisplayGroup* group);
+  void updateSceneBounds();
+  std::vector<Display*> culled_displays_;
+
+  bool prepareCameraInfo(std::string& frame_id);
+  void framePublished();
+  bool frame_due_;
+
+  // displays rendering the same image share one render and readback
+  static std::vector<CameraPub*> instances_;
+  std::string sharedRenderKey();
+  void collectVisibleDisplays(DisplayGroup* group, std::vector<Display*>& displays);
+  CameraPub* sharedRenderLeader();
+  void publishSharedFrame(const sensor_msgs::ImageConstPtr& native, Ogre::PixelFormat native_pf);
+  std::string shared_render_key_;
+  std::vector<CameraPub*> shared_followers_;
+
+  // the main 3D view is left unrendered while any display asks for it
+  void setMainViewSuspended(bool suspended);
+  void renderMainView();
+  static int main_view_suspenders_;
+  static ros::WallTime last_main_view_render_;
+  bool main_view_suspended_;
+
+  // partial rendering of what changed since the last frame
+  void publishTarget(const sensor_msgs::ImageConstPtr& native, Ogre::PixelFormat native_pf);
+  bool findDirtyRegion(Ogre::Box& region);
+  void renderRegion(Ogre::Box& region);
+  bool partial_render_;
+  // findDirtyRegion() ran for the frame being published
+  bool dirty_region_checked_;
+  Ogre::Box dirty_region_;
+  std::map<Display*, Ogre::AxisAlignedBox> display_bounds_;
+  Ogre::Matrix4 retained_view_projection_;
+  Ogre::ColourValue retained_background_;
+  int frames_since_full_render_;
+  // the last published frame in the texture format
+  sensor_msgs::ImagePtr retained_frame_;
+  Ogre::PixelFormat retained_pf_;
+
+  // static displays rendered once, dynamic ones every frame
+  void renderLayers();
+  void setDisplaysVisible(const std::vector<Display*>& displays, bool visible);
+  uint32_t static_vis_bit_;
+  rviz_camera_stream::LayerCompositor* layer_compositor_;
+  Ogre::Matrix4 static_view_projection_;
+  Ogre::ColourValue static_background_;
+  std::map<Display*, Ogre::AxisAlignedBox> static_bounds_;
+  ros::WallTime last_static_render_;
+  sensor_msgs::ImagePtr layer_frame_;
+
+  // jittered renders of an unchanged view averaged for antialiasing
+  bool collectDisplayBounds(std::map<Display*, Ogre::AxisAlignedBox>& bounds);
+  void renderAccumulated();
+  std::vector<uint32_t> accumulation_;
+  std::vector<uint8_t> accumulation_readback_;
+  uint32_t accumulation_samples_;
+  bool accumulating_;
+  Ogre::Matrix4 accumulation_view_projection_;
+  Ogre::ColourValue accumulation_background_;
+  std::map<Display*, Ogre::AxisAlignedBox> accumulation_bounds_;
+  ros::WallTime accumulation_start_;
+  sensor_msgs::ImagePtr accumulation_frame_;
+  bool updateOrthoCamera();
+  Ogre::TexturePtr createRenderTexture(unsigned int width, unsigned int height);
+  void resizeRenderTexture(unsigned int width, unsigned int height);
+  void releaseRetiredTexture();
+  bool isOrthographic() const;
+  bool isLidar() const;
+  void publishLidarScan();
+  void publishHeight(const std_msgs::Header& header);
+  bool isSharedMemoryInput() const;
+  bool pollSharedMemory();
 
   void clear();
   void updateStatus();
@@ -134,14 +324,96 @@ private:
 
   RosTopicProperty* topic_property_;
   RosTopicProperty* camera_info_property_;
+  StringProperty* multicast_group_property_;
+  IntProperty* multicast_port_property_;
+  IntProperty* multicast_ttl_property_;
+  StringProperty* multicast_interface_property_;
+  IntProperty* multicast_fragment_size_property_;
+  IntProperty* multicast_fec_group_property_;
+  StringProperty* gstreamer_pipeline_property_;
+  IntProperty* gstreamer_queue_property_;
+  IntProperty* burst_frames_property_;
+  RosTopicProperty* hq_topic_property_;
+  FloatProperty* hq_scale_property_;
+  IntProperty* hq_supersampling_property_;
+  FloatProperty* hq_lod_bias_property_;
   DisplayGroupVisibilityProperty* visibility_property_;
   IntProperty* queue_size_property_;
   StringProperty* namespace_property_;
 
   FloatProperty* frame_rate_property_;
+  BoolProperty* keyframe_property_;
+  FloatProperty* keyframe_translation_property_;
+  FloatProperty* keyframe_rotation_property_;
+  FloatProperty* keyframe_max_interval_property_;
+  FloatProperty* bandwidth_property_;
+  IntProperty* min_quality_property_;
+  IntProperty* max_quality_property_;
+  BoolProperty* diagnostics_property_;
+  BoolProperty* latency_probe_property_;
+  BoolProperty* warm_standby_property_;
+  IntProperty* frame_cache_size_property_;
+  FloatProperty* frame_cache_age_property_;
+  FloatProperty* probe_interval_property_;
+  FloatProperty* probe_timeout_property_;
   ColorProperty* background_color_property_;
   EnumProperty* image_encoding_property_;
   FloatProperty* near_clip_property_;
+  BoolProperty* frustum_culling_property_;
+  BoolProperty* share_render_property_;
+  BoolProperty* suspend_main_view_property_;
+  FloatProperty* main_view_rate_property_;
+  BoolProperty* partial_render_property_;
+  IntProperty* full_render_interval_property_;
+  BoolProperty* static_layer_property_;
+  FloatProperty* static_refresh_property_;
+  DisplayGroupVisibilityProperty* static_visibility_property_;
+  BoolProperty* accumulate_property_;
+  IntProperty* accumulation_samples_property_;
+  FloatProperty* accumulation_refresh_property_;
+
+  EnumProperty* projection_property_;
+  TfFrameProperty* ortho_frame_property_;
+  FloatProperty* ortho_resolution_property_;
+  FloatProperty* ortho_width_property_;
+  FloatProperty* ortho_height_property_;
+  FloatProperty* ortho_altitude_property_;
+  BoolProperty* publish_height_property_;
+  RosTopicProperty* height_topic_property_;
+
+  // orthographic mode has no incoming CameraInfo, one is synthesized
+  // from the ortho properties every update
+  sensor_msgs::CameraInfo ortho_caminfo_;
+  ros::Publisher height_pub_;
+
+  TfFrameProperty* lidar_frame_property_;
+  EnumProperty* lidar_faces_property_;
+  IntProperty* lidar_resolution_property_;
+  IntProperty* lidar_rings_property_;
+  FloatProperty* lidar_min_elevation_property_;
+  FloatProperty* lidar_max_elevation_property_;
+  IntProperty* lidar_samples_property_;
+  StringProperty* lidar_beam_table_property_;
+  FloatProperty* lidar_min_range_property_;
+  FloatProperty* lidar_max_range_property_;
+  RosTopicProperty* cloud_topic_property_;
+
+  rviz_camera_stream::DepthLidar* lidar_;
+  std::vector<rviz_camera_stream::DepthLidar::Beam> lidar_beams_;
+  ros::Publisher cloud_pub_;
+
+  IntProperty* strip_rows_property_;
+  BoolProperty* threaded_publishing_property_;
+
+  EnumProperty* input_property_;
+  StringProperty* shm_name_property_;
+
+  // camera state written by a simulator on the same host, replaces the
+  // CameraInfo subscription and the TF lookup of the camera pose
+  rviz_camera_stream::ShmCameraInput shm_input_;
+  Ogre::Vector3 shm_position_;
+  Ogre::Quaternion shm_orientation_;
+  uint64_t shm_step_;
 
   sensor_msgs::CameraInfo::ConstPtr current_caminfo_;
   boost::mutex caminfo_mutex_;
@@ -155,12 +427,27 @@ private:
   uint32_t vis_bit_;
 
   video_export::VideoPublisher* video_publisher_;
+  video_export::VideoPublisher* hq_publisher_;
+  rviz_camera_stream::MulticastImageSender multicast_sender_;
+  // oversized frames already reported
+  uint64_t multicast_oversized_;
+#ifdef RVIZ_CAMERA_STREAM_HAVE_GSTREAMER
+  rviz_camera_stream::GstreamerOutput gstreamer_output_;
+#endif
+  video_export::BandwidthController* bandwidth_controller_;
 
   // render to texture
   // from http://www.ogre3d.org/tikiwiki/tiki-index.php?page=Intermediate+Tutorial+7
   Ogre::Camera* camera_;
   Ogre::TexturePtr rtt_texture_;
   Ogre::RenderTexture* render_texture_;
+  // previous target after a resize, kept for one update
+  Ogre::TexturePtr retired_texture_;
+
+  // renders the same camera with the rviz "Depth" material scheme,
+  // only created when the height channel is requested
+  Ogre::TexturePtr depth_texture_;
+  Ogre::RenderTexture* depth_render_texture_;
 };
 
 }  // namespace rviz
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RVIZ_CAMERA_STREAM_DEPTH_LIDAR_H
+#define RVIZ_CAMERA_STREAM_DEPTH_LIDAR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <OgreQuaternion.h>
+#include <OgreTexture.h>
+#include <OgreVector3.h>
+
+#include <sensor_msgs/PointCloud2.h>
+
+namespace Ogre
+{
+class Camera;
+class RenderTexture;
+class SceneManager;
+}
+
+namespace rviz_camera_stream
+{
+
+/// Depth in units of the far clip distance from a pixel rendered with the rviz "Depth" material scheme, 0 for no hit
+inline float decodeDepth(const uint8_t* rgb)
+{
+  const uint32_t int_depth = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+  return static_cast<float>(int_depth) / static_cast<float>(0xffffff);
+}
+
+/**
+ * \class DepthLidar
+ * Simulates a multi beam lidar by rendering depth views around the sensor
+ * and looking every beam up in them.
+ *
+ * The beam directions are fixed, so for each beam the face, pixel and the
+ * factor from view depth to range are computed once in configure(), a scan
+ * is then only the face renders plus one lookup per beam.
+ */
+class DepthLidar
+{
+public:
+  struct Beam
+  {
+    uint16_t ring;
+    // radians, azimuth counter clockwise from +X, elevation up from the XY plane
+    float elevation;
+    float azimuth;
+  };
+
+  DepthLidar(Ogre::SceneManager* scene_manager, uint32_t visibility_mask);
+  ~DepthLidar();
+
+  /// Evenly spaced rings and azimuths
+  static std::vector<Beam> makeBeams(int rings, float min_elevation, float max_elevation, int horizontal_samples);
+  /// One beam per line: ring elevation_degrees azimuth_degrees, # starts a comment
+  static bool loadBeams(const std::string& path, std::vector<Beam>& beams, std::string& error);
+
+  /// faces is 4 (horizontal only) or 6, rebuilds the render targets and table when anything changed
+  void configure(const std::vector<Beam>& beams, int faces, int resolution, float min_range, float max_range);
+
+  /// Render around the sensor pose (in the fixed frame, x forward z up) and sample into cloud
+  void scan(const Ogre::Vector3& position, const Ogre::Quaternion& orientation, sensor_msgs::PointCloud2& cloud);
+
+  /// Beams outside of all faces, only possible with 4 faces
+  size_t uncoveredBeams() const;
+
+private:
+  struct Face
+  {
+    Ogre::Quaternion rotation;
+    Ogre::Camera* camera;
+    Ogre::TexturePtr depth_texture;
+    Ogre::TexturePtr color_texture;
+    Ogre::RenderTexture* depth_target;
+    Ogre::RenderTexture* color_target;
+    std::vector<uint8_t> depth;
+    std::vector<uint8_t> color;
+  };
+
+  struct Sample
+  {
+    uint16_t face;
+    uint16_t ring;
+    uint32_t pixel;
+    Ogre::Vector3 direction;
+    // range = depth / cosine between the beam and the face axis
+    float range_scale;
+  };
+
+  void destroyFaces();
+  Ogre::RenderTexture* createTarget(Ogre::TexturePtr& texture, Ogre::Camera* camera, const std::string& scheme);
+
+  Ogre::SceneManager* scene_manager_;
+  uint32_t visibility_mask_;
+
+  std::vector<Beam> beams_;
+  int resolution_;
+  float min_range_;
+  float max_range_;
+
+  std::vector<Face> faces_;
+  std::vector<Sample> samples_;
+  size_t uncovered_;
+};
+
+}  // namespace rviz_camera_stream
+
+#endif  // RVIZ_CAMERA_STREAM_DEPTH_LIDAR_H
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RVIZ_CAMERA_STREAM_FRAME_CACHE_H
+#define RVIZ_CAMERA_STREAM_FRAME_CACHE_H
+
+#include <deque>
+
+#include <boost/thread/mutex.hpp>
+#include <ros/time.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/Image.h>
+
+namespace rviz_camera_stream
+{
+
+/**
+ * \class FrameCache
+ * The last published frames in stamp order, for looking up the one nearest to
+ * a stamp or the two around it.
+ *
+ * The frames are kept as the shared pointers that were published, the cache
+ * holds on to them but never copies them. Frames are added from the publish
+ * thread and looked up from the rviz thread.
+ */
+class FrameCache
+{
+public:
+  struct Frame
+  {
+    sensor_msgs::ImageConstPtr image;
+    sensor_msgs::CameraInfoConstPtr camera_info;
+  };
+
+  FrameCache();
+
+  /// At most max_frames frames no older than max_age seconds before the newest one, 0 max_frames keeps none
+  void setLimits(size_t max_frames, double max_age);
+
+  /// Frames older than the newest one are dropped, the stamps go back after a rosbag loop or a sim time reset
+  void add(const sensor_msgs::ImageConstPtr& image, const sensor_msgs::CameraInfoConstPtr& camera_info);
+  void clear();
+
+  /// A zero stamp gives the newest frame
+  bool nearest(const ros::Time& stamp, Frame& frame);
+
+  /// The last frame at or before stamp and the first one at or after it, false if stamp is outside the cache
+  bool bracket(const ros::Time& stamp, Frame& before, Frame& after);
+
+  size_t size();
+  /// Of the oldest and newest frames, false when empty
+  bool span(ros::Time& oldest, ros::Time& newest);
+
+private:
+  void trim();
+
+  boost::mutex mutex_;
+  std::deque<Frame> frames_;
+  size_t max_frames_;
+  ros::Duration max_age_;
+};
+
+}  // namespace rviz_camera_stream
+
+#endif  // RVIZ_CAMERA_STREAM_FRAME_CACHE_H
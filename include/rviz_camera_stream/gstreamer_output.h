@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RVIZ_CAMERA_STREAM_GSTREAMER_OUTPUT_H
+#define RVIZ_CAMERA_STREAM_GSTREAMER_OUTPUT_H
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <sensor_msgs/Image.h>
+
+// only the implementation needs the GStreamer headers
+typedef struct _GstElement GstElement;
+
+namespace rviz_camera_stream
+{
+
+/**
+ * \class GstreamerOutput
+ * Pushes frames into a GStreamer pipeline through an appsrc.
+ *
+ * The GstBuffers wrap the image data without copying, each one holds a
+ * reference to its image until the pipeline releases the buffer, so pooled
+ * images only go back to their pool once GStreamer is done with them.
+ * Buffers are timestamped in the pipeline's running time and carry the ROS
+ * stamp of their image as a GstReferenceTimestampMeta with the caps
+ * timestamp/x-ros, where GStreamer is 1.14 or newer.
+ * Only built when GStreamer is found, RVIZ_CAMERA_STREAM_HAVE_GSTREAMER is
+ * defined then.
+ */
+class GstreamerOutput
+{
+public:
+  GstreamerOutput();
+  ~GstreamerOutput();
+
+  /// pipeline is everything after the appsrc, e.g. "videoconvert ! autovideosink"
+  bool start(const std::string& pipeline, std::string& error);
+  /// Returns right away, the pipeline gets its end of stream and is torn down on another thread
+  void stop();
+  /// False once the pipeline reported an error, start() brings up a new one
+  bool isRunning();
+  /// The pipeline passed to start()
+  std::string description();
+
+  /// Frames are dropped while more than max_queued are waiting in the appsrc
+  void setMaxQueued(size_t max_queued);
+
+  /// Returns false if the frame was dropped or the encoding has no raw video format
+  bool push(const sensor_msgs::ImageConstPtr& image);
+
+  /// First error the pipeline reported since start(), empty if none
+  std::string error();
+
+private:
+  void pollBus();
+
+  boost::mutex mutex_;
+  GstElement* pipeline_;
+  GstElement* appsrc_;
+  std::string description_;
+  size_t max_queued_;
+  // tears down the pipeline stop() took off, start() waits for it so a new
+  // pipeline does not write to a file the old one is still finishing
+  boost::scoped_ptr<boost::thread> finisher_;
+
+  // the caps are set again when any of these change
+  std::string encoding_;
+  uint32_t width_;
+  uint32_t height_;
+
+  std::string error_;
+};
+
+}  // namespace rviz_camera_stream
+
+#endif  // RVIZ_CAMERA_STREAM_GSTREAMER_OUTPUT_H
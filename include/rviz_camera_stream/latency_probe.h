@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RVIZ_CAMERA_STREAM_LATENCY_PROBE_H
+#define RVIZ_CAMERA_STREAM_LATENCY_PROBE_H
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+#include <OgreColourValue.h>
+#include <OgreMaterial.h>
+#include <ros/time.h>
+#include <sensor_msgs/Image.h>
+
+namespace Ogre
+{
+class Rectangle2D;
+class SceneManager;
+class SceneNode;
+}
+
+namespace rviz_camera_stream
+{
+
+/**
+ * \class LatencyProbe
+ * Measures how long a change in the scene takes to show up in a published image.
+ *
+ * A small quad in the top left corner of the camera view, seen only through
+ * visibility_mask, flips between black and white. The time of each flip is
+ * kept and every published image is checked for the new colour, the time until
+ * it is first seen is one latency sample.
+ * flip() is called from the render thread, check() from whichever thread
+ * publishes.
+ */
+class LatencyProbe
+{
+public:
+  struct Stats
+  {
+    Stats();
+
+    size_t samples;
+    size_t missed;
+    double min_ms;
+    double median_ms;
+    double p95_ms;
+    double max_ms;
+    double mean_ms;
+  };
+
+  LatencyProbe(Ogre::SceneManager* scene_manager, uint32_t visibility_mask);
+  ~LatencyProbe();
+
+  /// Shows or hides the quad, the samples are dropped either way
+  void setActive(bool active);
+  bool isActive() const;
+
+  /// Takes the quad out of renders that are not part of the live stream, there are no flips meanwhile
+  void setHidden(bool hidden);
+  bool isHidden() const;
+
+  /// Flips the quad when the last flip was seen at least interval seconds ago, or given up on after timeout
+  void update(double interval, double timeout);
+
+  /// Looks for the last flip in a published image of the whole camera view, or in a strip of it starting
+  /// at row y_offset of a frame_height rows high view. Strips without the middle of the quad are skipped.
+  void check(const sensor_msgs::Image& image, uint32_t y_offset = 0, uint32_t frame_height = 0);
+
+  /// Over the last samples
+  Stats stats();
+
+private:
+  void setColour(const Ogre::ColourValue& colour);
+
+  Ogre::SceneManager* scene_manager_;
+  Ogre::SceneNode* node_;
+  Ogre::Rectangle2D* quad_;
+  Ogre::MaterialPtr material_;
+  bool active_;
+
+  boost::mutex mutex_;
+  bool hidden_;
+  bool white_;
+  bool pending_;
+  ros::WallTime flip_time_;
+  // when the last flip was seen or given up on
+  ros::WallTime settle_time_;
+  std::deque<double> samples_;
+  size_t missed_;
+};
+
+}  // namespace rviz_camera_stream
+
+#endif  // RVIZ_CAMERA_STREAM_LATENCY_PROBE_H
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RVIZ_CAMERA_STREAM_LAYER_COMPOSITOR_H
+#define RVIZ_CAMERA_STREAM_LAYER_COMPOSITOR_H
+
+#include <stdint.h>
+#include <string>
+
+#include <OgreColourValue.h>
+#include <OgreMaterial.h>
+#include <OgreTexture.h>
+
+#include <sensor_msgs/Image.h>
+
+namespace Ogre
+{
+class Camera;
+class Rectangle2D;
+class RenderTexture;
+class SceneNode;
+}
+
+namespace rviz_camera_stream
+{
+
+/**
+ * \class LayerCompositor
+ * Renders a camera as a cached static layer plus a dynamic layer drawn
+ * every frame, composited by depth on the gpu.
+ *
+ * The static layer is rendered in colour and with the rviz "Depth" material
+ * scheme into textures that stay on the gpu. Each dynamic render starts with
+ * a full screen quad that copies the static colour into the target and turns
+ * the packed static depth back into the depth buffer, then the dynamic
+ * displays are drawn over it with the usual depth test. Only the result is
+ * read back.
+ * Which displays are in which layer is up to the caller, it sets the
+ * visibility bits before each render call.
+ */
+class LayerCompositor
+{
+public:
+  LayerCompositor(Ogre::Camera* camera, uint32_t visibility_mask);
+  ~LayerCompositor();
+
+  /// Recreates the targets when the size changed, which drops the static layer
+  void resize(int width, int height);
+
+  bool hasStaticLayer() const;
+
+  /// Render what is visible now as the static layer and keep its colour and depth
+  void renderStatic(const Ogre::ColourValue& background);
+
+  /// Render what is visible now over the static layer and read the result into image as PF_BYTE_RGB
+  void renderDynamic(sensor_msgs::Image& image);
+
+  /// Of the last dynamic render
+  size_t triangleCount() const;
+  size_t batchCount() const;
+
+private:
+  void destroyTargets();
+  Ogre::RenderTexture* createTarget(Ogre::TexturePtr& texture, const std::string& scheme);
+  void createRestoreQuad();
+
+  Ogre::Camera* camera_;
+  uint32_t visibility_mask_;
+  int width_;
+  int height_;
+  bool has_static_;
+
+  Ogre::TexturePtr color_texture_;
+  Ogre::TexturePtr depth_texture_;
+  Ogre::TexturePtr output_texture_;
+  Ogre::RenderTexture* color_target_;
+  Ogre::RenderTexture* depth_target_;
+  Ogre::RenderTexture* output_target_;
+
+  // draws the static layer into the output target before the dynamic displays
+  Ogre::MaterialPtr restore_material_;
+  Ogre::Rectangle2D* restore_quad_;
+  Ogre::SceneNode* restore_node_;
+};
+
+}  // namespace rviz_camera_stream
+
+#endif  // RVIZ_CAMERA_STREAM_LAYER_COMPOSITOR_H
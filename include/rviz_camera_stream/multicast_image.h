@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RVIZ_CAMERA_STREAM_MULTICAST_IMAGE_H
+#define RVIZ_CAMERA_STREAM_MULTICAST_IMAGE_H
+
+#include <netinet/in.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sensor_msgs/Image.h>
+
+namespace rviz_camera_stream
+{
+
+/**
+ * Header in front of every datagram, all fields in network byte order.
+ *
+ * A frame is the serialized sensor_msgs/Image cut into data_count fragments
+ * of fragment_size bytes, the last one shorter. With fec_group set, every
+ * fec_group data fragments are followed by a parity fragment, the xor of
+ * them, which lets the receiver rebuild one lost fragment per group.
+ * Parity fragments have index data_count + group.
+ */
+struct MulticastFragmentHeader
+{
+  static const uint32_t MAGIC = 0x52434d31;  // "RCM1"
+
+  uint32_t magic;
+  uint32_t frame;
+  uint32_t frame_size;
+  uint16_t index;
+  uint16_t data_count;
+  uint16_t fragment_size;
+  uint16_t fec_group;
+} __attribute__((packed));
+
+/**
+ * \class MulticastImageSender
+ * Sends every image once to a multicast group, however many receivers join it.
+ */
+class MulticastImageSender
+{
+public:
+  MulticastImageSender();
+  virtual ~MulticastImageSender();
+
+  /// interface_address selects the outgoing interface, empty for the default route
+  bool open(const std::string& group, int port, int ttl, const std::string& interface_address, std::string& error);
+  void close();
+  bool isOpen() const;
+
+  /// Payload bytes per datagram, keep header plus payload below the path MTU
+  void setFragmentSize(size_t fragment_size);
+  /// Data fragments per parity fragment, 0 sends no parity
+  void setFecGroup(size_t fec_group);
+
+  bool send(const sensor_msgs::Image& image);
+
+  uint64_t bytesSent() const;
+  /// Frames not sent because they need more than 0xffff datagrams at the fragment size
+  uint64_t oversized() const;
+
+protected:
+  /// Hands one datagram gathered from iov to the socket
+  virtual bool sendDatagram(iovec* iov, size_t count);
+
+private:
+  MulticastFragmentHeader makeHeader(uint16_t index) const;
+  bool sendFragment(uint16_t index, const uint8_t* data, size_t offset, size_t size);
+  void addParity(const uint8_t* data, size_t offset, size_t size);
+
+  int socket_;
+  sockaddr_in address_;
+  size_t fragment_size_;
+  size_t fec_group_;
+  uint32_t frame_;
+  uint32_t frame_size_;
+  uint16_t data_count_;
+  uint64_t bytes_sent_;
+  uint64_t oversized_;
+  // the serialized fields ahead of the pixel data
+  std::vector<uint8_t> prefix_;
+  std::vector<uint8_t> parity_;
+};
+
+/**
+ * \class MulticastImageReceiver
+ * Joins a group and puts the images back together, using the parity
+ * fragments for lost datagrams. Only max_pending frames are kept, older
+ * incomplete frames are dropped.
+ * Datagrams come from the network, so any whose header does not agree with
+ * the frame they belong to, or announces more than max_frame_size bytes, is
+ * dropped.
+ */
+class MulticastImageReceiver
+{
+public:
+  /// Socket receive buffer asked for, room for a few frames while the reader is busy
+  static const int RECEIVE_BUFFER_SIZE = 8 * 1024 * 1024;
+
+  /// Room for an 8k RGBA frame
+  static const size_t DEFAULT_MAX_FRAME_SIZE = 8192 * 4320 * 4;
+
+  explicit MulticastImageReceiver(size_t max_pending = 4, size_t max_frame_size = DEFAULT_MAX_FRAME_SIZE);
+  ~MulticastImageReceiver();
+
+  bool open(const std::string& group, int port, const std::string& interface_address, std::string& error);
+  void close();
+  bool isOpen() const;
+
+  /// The receive buffer the kernel granted, it clamps RECEIVE_BUFFER_SIZE to net.core.rmem_max
+  int receiveBufferSize() const;
+
+  /// Waits up to timeout_ms for datagrams, returns true once a frame is complete and fills image
+  bool receive(sensor_msgs::Image& image, int timeout_ms);
+  /// Adds one datagram however it was received, returns true once a frame is complete and fills image
+  bool addDatagram(const uint8_t* datagram, size_t size, sensor_msgs::Image& image);
+
+  /// Frames dropped because they were still incomplete when newer ones arrived
+  uint64_t dropped() const;
+  /// Fragments rebuilt from parity
+  uint64_t recovered() const;
+
+private:
+  struct PendingFrame
+  {
+    uint32_t frame_size;
+    uint16_t data_count;
+    uint16_t fragment_size;
+    uint16_t fec_group;
+    std::vector<uint8_t> data;
+    std::vector<bool> have;
+    std::vector<std::vector<uint8_t> > parity;
+    size_t received;
+  };
+
+  void recover(PendingFrame& pending, size_t group);
+  size_t fragmentLength(const PendingFrame& pending, size_t index) const;
+
+  int socket_;
+  size_t max_pending_;
+  size_t max_frame_size_;
+  std::map<uint32_t, PendingFrame> pending_;
+  std::vector<uint8_t> datagram_;
+  // last frame handed out, fragments of it or older ones are late
+  uint32_t last_frame_;
+  bool has_last_frame_;
+  uint64_t dropped_;
+  uint64_t recovered_;
+};
+
+}  // namespace rviz_camera_stream
+
+#endif  // RVIZ_CAMERA_STREAM_MULTICAST_IMAGE_H
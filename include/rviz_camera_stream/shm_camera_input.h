@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RVIZ_CAMERA_STREAM_SHM_CAMERA_INPUT_H
+#define RVIZ_CAMERA_STREAM_SHM_CAMERA_INPUT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace rviz_camera_stream
+{
+
+/**
+ * Layout of the shared memory region a simulator writes camera state into.
+ *
+ * The writer makes sequence odd, writes the fields, then makes it even again
+ * (a seqlock), so the reader never blocks the simulator. step increases by
+ * one or more per simulation step, rendered_step is written back by the
+ * reader once the frame for that step has been published.
+ */
+struct ShmCameraState
+{
+  static const uint32_t MAGIC = 0x52435331;  // "RCS1"
+  static const uint32_t VERSION = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  std::atomic<uint64_t> sequence;
+  std::atomic<uint64_t> rendered_step;
+
+  uint64_t step;
+  uint32_t stamp_sec;
+  uint32_t stamp_nsec;
+  char frame_id[64];
+
+  // pose of the optical (z forward) frame expressed in the rviz fixed frame
+  double position[3];
+  // x, y, z, w
+  double orientation[4];
+
+  uint32_t width;
+  uint32_t height;
+  // same meaning as sensor_msgs/CameraInfo P
+  double P[12];
+};
+
+/// A consistent copy of the region, taken by ShmCameraInput::read()
+struct ShmCameraSample
+{
+  uint64_t step;
+  uint32_t stamp_sec;
+  uint32_t stamp_nsec;
+  std::string frame_id;
+  double position[3];
+  double orientation[4];
+  uint32_t width;
+  uint32_t height;
+  double P[12];
+};
+
+/**
+ * \class ShmCameraInput
+ * Reader side used by CameraPub.
+ */
+class ShmCameraInput
+{
+public:
+  ShmCameraInput();
+
+  /// Map an existing region created by a ShmCameraWriter, returns false and fills error on failure
+  bool open(const std::string& name, std::string& error);
+  void close();
+  bool isOpen() const;
+  const std::string& name() const;
+
+  /// Returns true if a step newer than the last one read is available and copies it into sample
+  bool read(ShmCameraSample& sample);
+
+  /// Tell the simulator that the frame for this step has been published
+  void acknowledge(uint64_t step);
+
+private:
+  std::string name_;
+  boost::scoped_ptr<boost::interprocess::shared_memory_object> shm_;
+  boost::scoped_ptr<boost::interprocess::mapped_region> region_;
+  ShmCameraState* state_;
+  uint64_t last_step_;
+  bool has_step_;
+};
+
+/**
+ * \class ShmCameraWriter
+ * Simulator side, creates the region and publishes one state per step.
+ */
+class ShmCameraWriter
+{
+public:
+  ShmCameraWriter();
+  ~ShmCameraWriter();
+
+  bool create(const std::string& name, std::string& error);
+  void write(const ShmCameraSample& sample);
+
+  /// Last step CameraPub has published a frame for, to run the simulation in lockstep
+  uint64_t renderedStep() const;
+
+private:
+  std::string name_;
+  boost::scoped_ptr<boost::interprocess::shared_memory_object> shm_;
+  boost::scoped_ptr<boost::interprocess::mapped_region> region_;
+  ShmCameraState* state_;
+};
+
+}  // namespace rviz_camera_stream
+
+#endif  // RVIZ_CAMERA_STREAM_SHM_CAMERA_INPUT_H
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RVIZ_CAMERA_STREAM_STRIP_ASSEMBLER_H
+#define RVIZ_CAMERA_STREAM_STRIP_ASSEMBLER_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/Image.h>
+
+namespace rviz_camera_stream
+{
+
+/**
+ * \class StripAssembler
+ * Reassembles the strips CameraPub publishes when "Strip Rows" is set.
+ *
+ * Strips of one frame share the header stamp, the CameraInfo roi gives their
+ * position and the CameraInfo width/height the size of the full frame.
+ * Only max_pending frames are kept, older incomplete frames are dropped.
+ */
+class StripAssembler
+{
+public:
+  explicit StripAssembler(size_t max_pending = 2);
+
+  /// Returns the full frame once its last missing strip arrives, NULL otherwise
+  sensor_msgs::ImagePtr add(const sensor_msgs::ImageConstPtr& strip,
+                            const sensor_msgs::CameraInfoConstPtr& info);
+
+  /// Number of frames dropped because they were still incomplete when newer ones arrived
+  uint64_t dropped() const;
+
+private:
+  struct PendingFrame
+  {
+    sensor_msgs::ImagePtr image;
+    // a strip sent twice or overlapping another one only counts its new rows
+    std::vector<bool> have_row;
+    uint32_t rows_received;
+  };
+
+  size_t max_pending_;
+  std::deque<PendingFrame> pending_;
+  uint64_t dropped_;
+  // of the newest frame that was completed or dropped
+  ros::Time done_stamp_;
+};
+
+}  // namespace rviz_camera_stream
+
+#endif  // RVIZ_CAMERA_STREAM_STRIP_ASSEMBLER_H
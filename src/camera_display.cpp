@@ -29,20 +29,27 @@
 
 #include <rviz/bit_allocator.h>
 #include <rviz/display_context.h>
+#include <rviz/display_group.h>
 #include <rviz/frame_manager.h>
 #include <rviz/load_resource.h>
+#include <rviz/render_panel.h>
 #include <rviz/ogre_helpers/axes.h>
+#include <rviz/properties/bool_property.h>
 #include <rviz/properties/display_group_visibility_property.h>
 #include <rviz/properties/enum_property.h>
 #include <rviz/properties/float_property.h>
 #include <rviz/properties/int_property.h>
 #include <rviz/properties/ros_topic_property.h>
+#include <rviz/properties/string_property.h>
 #include <rviz/properties/color_property.h>
+#include <rviz/properties/tf_frame_property.h>
 #include <rviz/uniform_string_stream.h>
 #include <rviz/validate_floats.h>
+#include <rviz/view_manager.h>
 #include <OgreCamera.h>
 #include <OgreHardwarePixelBuffer.h>
 #include <OgreManualObject.h>
+#include <OgreMatrix4.h>
 #include <OgreMaterialManager.h>
 #include <OgreRectangle2D.h>
 #include <OgreRenderSystem.h>
@@ -53,8 +60,21 @@
 #include <OgreTextureManager.h>
 #include <OgreViewport.h>
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <map>
 #include <image_transport/camera_common.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <dynamic_reconfigure/Reconfigure.h>
 #include <image_transport/image_transport.h>
+#include <ros/param.h>
+#include <ros/topic_manager.h>
+#include <sensor_msgs/CompressedImage.h>
 #include <sensor_msgs/image_encodings.h>
 #include <string>
 #include <tf/transform_listener.h>
@@ -63,19 +83,219 @@
 
 namespace video_export
 {
+// Hands out images that nothing else holds on to anymore, so their
+// data vectors keep their capacity from frame to frame
+class ImagePool
+{
+private:
+  boost::mutex mutex_;
+  std::vector<sensor_msgs::ImagePtr> images_;
+  size_t max_size_;
+public:
+  explicit ImagePool(size_t max_size) :
+    max_size_(max_size)
+  {
+  }
+
+  // images dropped from the pool stay valid wherever they are still used
+  void setMaxSize(size_t max_size)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    max_size_ = max_size;
+    if (images_.size() > max_size_)
+    {
+      images_.resize(max_size_);
+    }
+  }
+
+  sensor_msgs::ImagePtr acquire()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    for (size_t i = 0; i < images_.size(); ++i)
+    {
+      if (images_[i].unique())
+      {
+        return images_[i];
+      }
+    }
+    sensor_msgs::ImagePtr image(new sensor_msgs::Image);
+    if (images_.size() < max_size_)
+    {
+      images_.push_back(image);
+    }
+    return image;
+  }
+};
+
 class VideoPublisher
 {
 private:
   ros::NodeHandle nh_;
   image_transport::ImageTransport it_;
   image_transport::CameraPublisher pub_;
+  // pub_ is used from the publish thread as well
+  boost::mutex pub_mutex_;
   uint image_id_;
+  uint32_t queue_size_;
+  std::vector<uint8_t> native_frame_;
+
+  ImagePool pool_;
+
+  // optional further outputs, every full frame is sent to them as well
+  rviz_camera_stream::MulticastImageSender* multicast_;
+  rviz_camera_stream::GstreamerOutput* gstreamer_;
+  rviz_camera_stream::LatencyProbe* probe_;
+  rviz_camera_stream::FrameCache* cache_;
+
+  // with pub_mutex_ held
+  void sendToOutputs(const sensor_msgs::ImageConstPtr& image, const sensor_msgs::CameraInfoConstPtr& camera_info)
+  {
+    if (cache_)
+    {
+      cache_->add(image, camera_info);
+    }
+    if (probe_)
+    {
+      probe_->check(*image);
+    }
+    if (multicast_)
+    {
+      multicast_->send(*image);
+    }
+#ifdef RVIZ_CAMERA_STREAM_HAVE_GSTREAMER
+    if (gstreamer_)
+    {
+      gstreamer_->push(image);
+    }
+#endif
+  }
+
+  // a frame read back in the texture format, waiting for the publish thread
+  struct PendingFrame
+  {
+    sensor_msgs::ImageConstPtr native;
+    Ogre::PixelFormat native_pf;
+    Ogre::PixelFormat pf;
+    std::string encoding;
+    std_msgs::Header header;
+    sensor_msgs::CameraInfo camera_info;
+  };
+  boost::scoped_ptr<boost::thread> thread_;
+  boost::mutex frame_mutex_;
+  boost::condition_variable frame_cond_;
+  PendingFrame pending_frame_;
+  bool frame_pending_;
+  bool stop_;
+
+  void run()
+  {
+    while (true)
+    {
+      PendingFrame frame;
+      {
+        boost::mutex::scoped_lock lock(frame_mutex_);
+        while (!frame_pending_ && !stop_)
+        {
+          frame_cond_.wait(lock);
+        }
+        if (stop_)
+        {
+          return;
+        }
+        frame = pending_frame_;
+        pending_frame_ = PendingFrame();
+        frame_pending_ = false;
+      }
+
+      sensor_msgs::ImagePtr image = convert(*frame.native, frame.native_pf, frame.pf, frame.encoding, frame.header);
+      // the native image can be reused while this one is serialized
+      frame.native.reset();
+
+      sensor_msgs::CameraInfoConstPtr camera_info = boost::make_shared<sensor_msgs::CameraInfo>(frame.camera_info);
+      boost::mutex::scoped_lock lock(pub_mutex_);
+      if (pub_.getTopic() != "")
+      {
+        pub_.publish(image, camera_info);
+      }
+      sendToOutputs(image, camera_info);
+    }
+  }
+
+  sensor_msgs::ImagePtr convert(const sensor_msgs::Image& native, Ogre::PixelFormat native_pf,
+                                Ogre::PixelFormat pf, const std::string& encoding,
+                                const std_msgs::Header& header)
+  {
+    sensor_msgs::ImagePtr image = pool_.acquire();
+    image->header = header;
+    image->encoding = encoding;
+    image->height = native.height;
+    image->width = native.width;
+    image->step = Ogre::PixelUtil::getNumElemBytes(pf) * native.width;
+    image->is_bigendian = native.is_bigendian;
+    image->data.resize(image->step * native.height);
+    Ogre::PixelBox src(native.width, native.height, 1, native_pf,
+                       const_cast<uint8_t*>(&native.data[0]));
+    Ogre::PixelBox dst(native.width, native.height, 1, pf, &image->data[0]);
+    Ogre::PixelUtil::bulkPixelConversion(src, dst);
+    return image;
+  }
+
 public:
+  // frames being read back, published or serialized at the same time
+  static const size_t POOL_SIZE = 4;
+
   sensor_msgs::CameraInfo camera_info_;
+  // time spent in the last readback and in converting and publishing it,
+  // with threaded publishing the latter only covers handing the frame over
+  ros::WallDuration readback_duration_;
+  ros::WallDuration publish_duration_;
   VideoPublisher() :
     it_(nh_),
-    image_id_(0)
+    image_id_(0),
+    queue_size_(1),
+    pool_(POOL_SIZE),
+    multicast_(NULL),
+    gstreamer_(NULL),
+    probe_(NULL),
+    cache_(NULL),
+    frame_pending_(false),
+    stop_(false)
+  {
+  }
+
+  ~VideoPublisher()
+  {
+    setThreaded(false);
+  }
+
+  // Convert and publish on a separate thread, the caller only does the readback.
+  // Rendering and the readback stay on the rviz thread: Ogre 1.9 as rviz uses
+  // it has one GL context and no thread support in its render system, and the
+  // scene graph the camera renders is changed by the other displays on that
+  // thread, so a second thread with a shared context could not render it.
+  // The publish thread always takes the newest frame, older ones that it did not
+  // get to are dropped instead of queueing up behind a slow subscriber.
+  void setThreaded(bool threaded)
   {
+    if (threaded == static_cast<bool>(thread_))
+    {
+      return;
+    }
+    if (threaded)
+    {
+      stop_ = false;
+      thread_.reset(new boost::thread(boost::bind(&VideoPublisher::run, this)));
+      return;
+    }
+    {
+      boost::mutex::scoped_lock lock(frame_mutex_);
+      stop_ = true;
+      frame_pending_ = false;
+      pending_frame_ = PendingFrame();
+    }
+    frame_cond_.notify_all();
+    thread_->join();
+    thread_.reset();
   }
 
   std::string get_topic()
@@ -97,165 +317,1114 @@ public:
 
   void shutdown()
   {
+    boost::mutex::scoped_lock lock(pub_mutex_);
     if (pub_.getTopic() != "")
     {
       pub_.shutdown();
     }
   }
 
-  void advertise(std::string topic)
+  // Strips are not sent, only full frames
+  void setMulticast(rviz_camera_stream::MulticastImageSender* multicast)
   {
-    pub_ = it_.advertiseCamera(topic, 1);
+    boost::mutex::scoped_lock lock(pub_mutex_);
+    multicast_ = multicast;
   }
 
-  // bool publishFrame(Ogre::RenderWindow * render_object, const std::string frame_id)
-  bool publishFrame(Ogre::RenderTexture * render_object, const std::string frame_id, int encoding_option)
+  void setGstreamer(rviz_camera_stream::GstreamerOutput* gstreamer)
+  {
+    boost::mutex::scoped_lock lock(pub_mutex_);
+    gstreamer_ = gstreamer;
+  }
+
+  // Every published full frame and the strip with the middle of the quad are checked
+  void setProbe(rviz_camera_stream::LatencyProbe* probe)
+  {
+    boost::mutex::scoped_lock lock(pub_mutex_);
+    probe_ = probe;
+  }
+
+  // Full frames are kept as published, strips are not. The pool grows by the
+  // frames the cache holds on to, they are recycled once they leave it.
+  void setCache(rviz_camera_stream::FrameCache* cache, size_t cache_size)
+  {
+    pool_.setMaxSize(POOL_SIZE + cache_size);
+    boost::mutex::scoped_lock lock(pub_mutex_);
+    cache_ = cache;
+  }
+
+  // The strips of a frame go out back to back, the queue has to hold all of
+  // them or a subscriber that is behind only gets the last ones
+  void advertise(std::string topic, uint32_t queue_size = 1)
+  {
+    boost::mutex::scoped_lock lock(pub_mutex_);
+    queue_size_ = queue_size;
+    pub_ = it_.advertiseCamera(topic, queue_size_);
+  }
+
+  static uint32_t stripQueueSize(int height, int strip_rows)
+  {
+    // room for the start of the next frame
+    return (height + strip_rows - 1) / strip_rows + 2;
+  }
+
+  static bool getEncoding(int encoding_option, Ogre::PixelFormat& pf, std::string& encoding)
   {
-    if (pub_.getTopic() == "")
-    {
-      return false;
-    }
-    if (frame_id == "")
-    {
-      return false;
-    }
-    // RenderTarget::writeContentsToFile() used as example
-    // TODO(lucasw) make things const that can be
-    int height = render_object->getHeight();
-    int width = render_object->getWidth();
-    // the suggested pixel format is most efficient, but other ones
-    // can be used.
-    sensor_msgs::Image image;
-    Ogre::PixelFormat pf = Ogre::PF_BYTE_RGB;
     switch (encoding_option)
     {
       case 0:
         pf = Ogre::PF_BYTE_RGB;
-        image.encoding = sensor_msgs::image_encodings::RGB8;
+        encoding = sensor_msgs::image_encodings::RGB8;
         break;
       case 1:
         pf = Ogre::PF_BYTE_RGBA;
-        image.encoding = sensor_msgs::image_encodings::RGBA8;
+        encoding = sensor_msgs::image_encodings::RGBA8;
         break;
       case 2:
         pf = Ogre::PF_BYTE_BGR;
-        image.encoding = sensor_msgs::image_encodings::BGR8;
+        encoding = sensor_msgs::image_encodings::BGR8;
         break;
       case 3:
         pf = Ogre::PF_BYTE_BGRA;
-        image.encoding = sensor_msgs::image_encodings::BGRA8;
+        encoding = sensor_msgs::image_encodings::BGRA8;
         break;
       case 4:
         pf = Ogre::PF_L8;
-        image.encoding = sensor_msgs::image_encodings::MONO8;
+        encoding = sensor_msgs::image_encodings::MONO8;
         break;
       case 5:
         pf = Ogre::PF_L16;
-        image.encoding = sensor_msgs::image_encodings::MONO16;
+        encoding = sensor_msgs::image_encodings::MONO16;
         break;
       default:
         ROS_ERROR_STREAM("Invalid image encoding value specified");
         return false;
     }
+    return true;
+  }
 
-    uint pixelsize = Ogre::PixelUtil::getNumElemBytes(pf);
-    uint datasize = width * height * pixelsize;
+  // Publish the frame as a series of images strip_rows high, each with a CameraInfo
+  // whose roi says where the strip goes in the full frame. All strips of a frame
+  // share the header stamp, rviz_camera_stream::StripAssembler puts them back together.
+  // The texture is read back once in its own format, the conversion to the output
+  // encoding and the serialization happen per strip so the first rows are on the
+  // wire before the last ones are converted.
+  bool publishStrips(Ogre::RenderTexture * render_object, const std::string frame_id, int encoding_option,
+                     int strip_rows)
+  {
+    if (pub_.getTopic() == "")
+    {
+      return false;
+    }
+    if (frame_id == "")
+    {
+      return false;
+    }
+    Ogre::PixelFormat pf = Ogre::PF_BYTE_RGB;
+    std::string encoding;
+    if (!getEncoding(encoding_option, pf, encoding))
+    {
+      return false;
+    }
+
+    const int height = render_object->getHeight();
+    const int width = render_object->getWidth();
+    // after a resize or a change of Strip Rows, which subscribers reconnect from
+    if (stripQueueSize(height, strip_rows) > queue_size_)
+    {
+      advertise(pub_.getTopic(), stripQueueSize(height, strip_rows));
+    }
+    const Ogre::PixelFormat native_pf = render_object->suggestPixelFormat();
+    native_frame_.resize(Ogre::PixelUtil::getMemorySize(width, height, 1, native_pf));
+    Ogre::PixelBox native(width, height, 1, native_pf, &native_frame_[0]);
+    const ros::WallTime readback_start = ros::WallTime::now();
+    render_object->copyContentsToMemory(native, Ogre::RenderTarget::FB_AUTO);
+    const ros::WallTime readback_end = ros::WallTime::now();
+    readback_duration_ = readback_end - readback_start;
+
+    std_msgs::Header header;
+    header.stamp = ros::Time::now();
+    header.seq = image_id_++;
+    header.frame_id = frame_id;
+    camera_info_.header = header;
+
+    const uint pixelsize = Ogre::PixelUtil::getNumElemBytes(pf);
+    for (int y0 = 0; y0 < height; y0 += strip_rows)
+    {
+      const int rows = std::min(strip_rows, height - y0);
+
+      sensor_msgs::Image strip;
+      strip.header = header;
+      strip.encoding = encoding;
+      strip.height = rows;
+      strip.width = width;
+      strip.step = pixelsize * width;
+      strip.is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+      strip.data.resize(strip.step * rows);
+
+      Ogre::PixelBox src = native.getSubVolume(Ogre::Box(0, y0, width, y0 + rows));
+      Ogre::PixelBox dst(width, rows, 1, pf, &strip.data[0]);
+      Ogre::PixelUtil::bulkPixelConversion(src, dst);
+
+      sensor_msgs::CameraInfo info = camera_info_;
+      info.roi.x_offset = 0;
+      info.roi.y_offset = y0;
+      info.roi.width = width;
+      info.roi.height = rows;
+      boost::mutex::scoped_lock lock(pub_mutex_);
+      pub_.publish(strip, info);
+      if (probe_)
+      {
+        probe_->check(strip, y0, height);
+      }
+    }
+    publish_duration_ = ros::WallTime::now() - readback_end;
+    return true;
+  }
 
-    // 1.05 multiplier is to avoid crash when the window is resized.
-    // There should be a better solution.
-    uchar *data = OGRE_ALLOC_T(uchar, datasize * 1.05, Ogre::MEMCATEGORY_RENDERSYS);
-    Ogre::PixelBox pb(width, height, 1, pf, data);
+  // Read the target back in its own format, which is a plain copy. The
+  // conversion to an output encoding is left to publishNative().
+  sensor_msgs::ImagePtr readNative(Ogre::RenderTexture * render_object, Ogre::PixelFormat& native_pf)
+  {
+    const int height = render_object->getHeight();
+    const int width = render_object->getWidth();
+    native_pf = render_object->suggestPixelFormat();
+    sensor_msgs::ImagePtr native = pool_.acquire();
+    native->data.resize(Ogre::PixelUtil::getMemorySize(width, height, 1, native_pf));
+    Ogre::PixelBox pb(width, height, 1, native_pf, &native->data[0]);
+    const ros::WallTime readback_start = ros::WallTime::now();
     render_object->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+    readback_duration_ = ros::WallTime::now() - readback_start;
+
+    native->header.stamp = ros::Time::now();
+    native->height = height;
+    native->width = width;
+    native->is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+    return native;
+  }
+
+  // Read back only region of the target into frame, the rest of it keeps the
+  // earlier readbacks. A frame of the wrong size or format is replaced and read
+  // completely, one still held by the publish thread is copied before writing.
+  void readRegion(const Ogre::HardwarePixelBufferSharedPtr& buffer, Ogre::Box region,
+                  sensor_msgs::ImagePtr& frame, Ogre::PixelFormat& native_pf)
+  {
+    const int width = buffer->getWidth();
+    const int height = buffer->getHeight();
+    const ros::WallTime readback_start = ros::WallTime::now();
+    if (!frame || (frame->width != width) || (frame->height != height) || (native_pf != buffer->getFormat()))
+    {
+      native_pf = buffer->getFormat();
+      frame.reset(new sensor_msgs::Image);
+      frame->height = height;
+      frame->width = width;
+      frame->is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+      frame->data.resize(Ogre::PixelUtil::getMemorySize(width, height, 1, native_pf));
+      region = Ogre::Box(0, 0, width, height);
+    }
+    else if (!frame.unique())
+    {
+      frame.reset(new sensor_msgs::Image(*frame));
+    }
+    if ((region.getWidth() > 0) && (region.getHeight() > 0))
+    {
+      Ogre::PixelBox pb(width, height, 1, native_pf, &frame->data[0]);
+      buffer->blitToMemory(region, pb.getSubVolume(region));
+    }
+    readback_duration_ = ros::WallTime::now() - readback_start;
+    frame->header.stamp = ros::Time::now();
+  }
 
+  // Convert a frame from readNative() to the output encoding and publish it,
+  // on the publish thread if there is one. The native frame is not modified
+  // so it can be shared between publishers.
+  // With queue false the frame is converted and published before returning even
+  // with a publish thread, which would otherwise drop it for a newer one.
+  bool publishNative(const sensor_msgs::ImageConstPtr& native, Ogre::PixelFormat native_pf,
+                     const std::string& frame_id, int encoding_option, bool queue = true)
+  {
+    if (pub_.getTopic() == "")
+    {
+      return false;
+    }
+    if (frame_id == "")
+    {
+      return false;
+    }
+    Ogre::PixelFormat pf = Ogre::PF_BYTE_RGB;
+    std::string encoding;
+    if (!getEncoding(encoding_option, pf, encoding))
+    {
+      return false;
+    }
 
-    image.header.stamp = ros::Time::now();
-    image.header.seq = image_id_++;
-    image.header.frame_id = frame_id;
-    image.height = height;
-    image.width = width;
-    image.step = pixelsize * width;
-    image.is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
-    image.data.resize(datasize);
-    memcpy(&image.data[0], data, datasize);
-    camera_info_.header = image.header;
-    pub_.publish(image, camera_info_);
+    const ros::WallTime start = ros::WallTime::now();
+    std_msgs::Header header;
+    header.stamp = native->header.stamp;
+    header.seq = image_id_++;
+    header.frame_id = frame_id;
+    camera_info_.header = header;
 
-    OGRE_FREE(data, Ogre::MEMCATEGORY_RENDERSYS);
+    if (thread_ && queue)
+    {
+      {
+        boost::mutex::scoped_lock lock(frame_mutex_);
+        pending_frame_.native = native;
+        pending_frame_.native_pf = native_pf;
+        pending_frame_.pf = pf;
+        pending_frame_.encoding = encoding;
+        pending_frame_.header = header;
+        pending_frame_.camera_info = camera_info_;
+        frame_pending_ = true;
+      }
+      frame_cond_.notify_one();
+    }
+    else
+    {
+      sensor_msgs::ImagePtr image = convert(*native, native_pf, pf, encoding, header);
+      sensor_msgs::CameraInfoConstPtr camera_info = boost::make_shared<sensor_msgs::CameraInfo>(camera_info_);
+      boost::mutex::scoped_lock lock(pub_mutex_);
+      pub_.publish(image, camera_info);
+      sendToOutputs(image, camera_info);
+    }
+    publish_duration_ = ros::WallTime::now() - start;
     return true;
   }
-};
-}  // namespace video_export
 
+  // bool publishFrame(Ogre::RenderWindow * render_object, const std::string frame_id)
+  bool publishFrame(Ogre::RenderTexture * render_object, const std::string frame_id, int encoding_option)
+  {
+    if (pub_.getTopic() == "")
+    {
+      return false;
+    }
+    if (frame_id == "")
+    {
+      return false;
+    }
+    // RenderTarget::writeContentsToFile() used as example
+    // TODO(lucasw) make things const that can be
+    int height = render_object->getHeight();
+    int width = render_object->getWidth();
+    // the suggested pixel format is most efficient, but other ones
+    // can be used.
+    std::string encoding;
+    Ogre::PixelFormat pf = Ogre::PF_BYTE_RGB;
+    if (!getEncoding(encoding_option, pf, encoding))
+    {
+      return false;
+    }
 
-namespace rviz
-{
+    // reading back in the texture format is a plain copy, any conversion
+    // to the output encoding is left to the publish thread
+    if (thread_)
+    {
+      Ogre::PixelFormat native_pf;
+      sensor_msgs::ImagePtr native = readNative(render_object, native_pf);
+      return publishNative(native, native_pf, frame_id, encoding_option);
+    }
 
-const QString CameraPub::BACKGROUND("background");
-const QString CameraPub::OVERLAY("overlay");
-const QString CameraPub::BOTH("background and overlay");
+    uint pixelsize = Ogre::PixelUtil::getNumElemBytes(pf);
+    uint datasize = width * height * pixelsize;
 
-bool validateFloats(const sensor_msgs::CameraInfo& msg)
-{
-  bool valid = true;
-  valid = valid && validateFloats(msg.D);
-  valid = valid && validateFloats(msg.K);
-  valid = valid && validateFloats(msg.R);
-  valid = valid && validateFloats(msg.P);
-  return valid;
-}
+    // read back straight into a pooled message, the box is sized from the
+    // same target that is read so a resize can not overrun it
+    sensor_msgs::ImagePtr image = pool_.acquire();
+    image->encoding = encoding;
+    image->data.resize(datasize);
+    Ogre::PixelBox pb(width, height, 1, pf, &image->data[0]);
+    const ros::WallTime readback_start = ros::WallTime::now();
+    render_object->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+    const ros::WallTime readback_end = ros::WallTime::now();
+    readback_duration_ = readback_end - readback_start;
+
+    image->header.stamp = ros::Time::now();
+    image->header.seq = image_id_++;
+    image->header.frame_id = frame_id;
+    image->height = height;
+    image->width = width;
+    image->step = pixelsize * width;
+    image->is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+    camera_info_.header = image->header;
+    sensor_msgs::CameraInfoConstPtr camera_info = boost::make_shared<sensor_msgs::CameraInfo>(camera_info_);
+    boost::mutex::scoped_lock lock(pub_mutex_);
+    pub_.publish(image, camera_info);
+    sendToOutputs(image, camera_info);
+    publish_duration_ = ros::WallTime::now() - readback_end;
+    return true;
+  }
+};
 
-CameraPub::CameraPub()
-  : Display()
-  , camera_trigger_name_("camera_trigger")
-  , nh_()
-  , new_caminfo_(false)
-  , force_render_(false)
-  , trigger_activated_(false)
-  , last_image_publication_time_(0)
-  , caminfo_ok_(false)
-  , video_publisher_(0)
+// Keeps the compressed image_transport stream of one output topic near a
+// bit rate target. The achieved rate is measured on our own subscription
+// to the compressed topic, the jpeg quality is set through the plugin's
+// dynamic_reconfigure service and once the quality is at its minimum the
+// frame rate is limited as well.
+// The subscription only exists while something else subscribes to the
+// compressed topic, it would make the plugin encode every frame otherwise.
+class BandwidthController
 {
-  topic_property_ = new RosTopicProperty("Image Topic", "",
-      QString::fromStdString(ros::message_traits::datatype<sensor_msgs::Image>()),
-      "sensor_msgs::Image topic to publish to.", this, SLOT(updateTopic()));
+private:
+  ros::NodeHandle nh_;
+  std::string topic_;
+  ros::Subscriber sub_;
+
+  boost::mutex mutex_;
+  uint64_t bytes_;
+  uint32_t frames_;
+
+  ros::WallTime last_update_;
+  double smoothed_bps_;
+  double fps_;
+  int quality_;
+  float rate_limit_;
+
+  // shared with the thread calling the reconfigure service, which may
+  // outlive the controller as the call needs the rviz thread to be answered
+  struct QualityRequest
+  {
+    ros::ServiceClient client;
+    boost::mutex mutex;
+    int applied_quality;
+    bool call_in_flight;
+  };
+  boost::shared_ptr<QualityRequest> request_;
+
+  void compressedCallback(const sensor_msgs::CompressedImageConstPtr& msg)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    bytes_ += msg->data.size();
+    ++frames_;
+  }
 
-  namespace_property_ = new StringProperty("Display namespace", "",
-      "Namespace for this display.", this, SLOT(updateDisplayNamespace()));
+  static void setQuality(boost::shared_ptr<QualityRequest> request, int quality)
+  {
+    dynamic_reconfigure::Reconfigure srv;
+    dynamic_reconfigure::IntParameter param;
+    param.name = "jpeg_quality";
+    param.value = quality;
+    srv.request.config.ints.push_back(param);
+    const bool ok = request->client.call(srv);
+
+    boost::mutex::scoped_lock lock(request->mutex);
+    if (ok)
+    {
+      request->applied_quality = quality;
+    }
+    request->call_in_flight = false;
+  }
 
-  camera_info_property_ = new RosTopicProperty("Camera Info Topic", "",
-      QString::fromStdString(ros::message_traits::datatype<sensor_msgs::CameraInfo>()),
-      "sensor_msgs::CameraInfo topic to subscribe to.", this, SLOT(updateTopic()));
+public:
+  BandwidthController() :
+    bytes_(0),
+    frames_(0),
+    smoothed_bps_(0.0),
+    fps_(0.0),
+    quality_(80),
+    rate_limit_(0.0)
+  {
+  }
 
-  queue_size_property_ = new IntProperty( "Queue Size", 2,
-      "Advanced: set the size of the incoming message queue.  Increasing this "
-      "is useful if your incoming TF data is delayed significantly from your"
-      " image data, but it can greatly increase memory usage if the messages are big.",
-                                          this, SLOT(updateQueueSize()));
-  queue_size_property_->setMin(1);
+  ~BandwidthController()
+  {
+    stop();
+  }
 
-  frame_rate_property_ = new FloatProperty("Frame Rate", -1,
-      "Sets target frame rate. Set to < 0 for maximum speed, set to 0 to stop, you can "
-      "trigger single images with the /rviz_camera_trigger service.",
-                                           this, SLOT(updateFrameRate()));
-  frame_rate_property_->setMin(-1);
+  void start(ros::NodeHandle& nh, const std::string& image_topic, int quality)
+  {
+    stop();
+    nh_ = nh;
+    topic_ = nh.resolveName(image_topic) + "/compressed";
+    request_ = boost::make_shared<QualityRequest>();
+    request_->client = nh.serviceClient<dynamic_reconfigure::Reconfigure>(topic_ + "/set_parameters");
+    request_->applied_quality = -1;
+    request_->call_in_flight = false;
+    last_update_ = ros::WallTime::now();
+    bytes_ = 0;
+    frames_ = 0;
+    smoothed_bps_ = 0.0;
+    fps_ = 0.0;
+    quality_ = quality;
+    rate_limit_ = 0.0;
+  }
 
-  background_color_property_ = new ColorProperty("Background Color", Qt::black,
-      "Sets background color, values from 0.0 to 1.0.",
-                                           this, SLOT(updateBackgroundColor()));
+  void stop()
+  {
+    sub_.shutdown();
+    topic_.clear();
+    request_.reset();
+    rate_limit_ = 0.0;
+  }
 
-  image_encoding_property_ = new EnumProperty("Image Encoding", "rgb8",
-      "Sets the image encoding", this, SLOT(updateImageEncoding()));
-  image_encoding_property_->addOption("rgb8", 0);
-  image_encoding_property_->addOption("rgba8", 1);
-  image_encoding_property_->addOption("bgr8", 2);
-  image_encoding_property_->addOption("bgra8", 3);
-  image_encoding_property_->addOption("mono8", 4);
-  image_encoding_property_->addOption("mono16", 5);
+  bool is_active() const
+  {
+    return !topic_.empty();
+  }
 
-  near_clip_property_ = new FloatProperty("Near Clip Distance", 0.01, "Set the near clip distance",
-      this, SLOT(updateNearClipDistance()));
-  near_clip_property_->setMin(0.01);
-}
+  // Nothing but possibly ourselves subscribes to the compressed topic
+  bool is_idle() const
+  {
+    return sub_.getTopic().empty();
+  }
+
+  const std::string& topic() const
+  {
+    return topic_;
+  }
+
+  // Returns true once per period when a new estimate was made
+  bool update(double target_bps, int min_quality, int max_quality)
+  {
+    if (!is_active())
+    {
+      return false;
+    }
+    const ros::WallTime now = ros::WallTime::now();
+    const double dt = (now - last_update_).toSec();
+    if (dt < 1.0)
+    {
+      return false;
+    }
+    last_update_ = now;
+
+    // the count includes our own intraprocess subscription
+    const int others = static_cast<int>(ros::TopicManager::instance()->getNumSubscribers(topic_)) -
+        (is_idle() ? 0 : 1);
+    if ((others <= 0) != is_idle())
+    {
+      if (others <= 0)
+      {
+        sub_.shutdown();
+        rate_limit_ = 0.0;
+        smoothed_bps_ = 0.0;
+        fps_ = 0.0;
+      }
+      else
+      {
+        sub_ = nh_.subscribe(topic_, 1, &BandwidthController::compressedCallback, this);
+      }
+      boost::mutex::scoped_lock lock(mutex_);
+      bytes_ = 0;
+      frames_ = 0;
+      return true;
+    }
+    if (is_idle())
+    {
+      return true;
+    }
+
+    uint64_t bytes;
+    uint32_t frames;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      bytes = bytes_;
+      frames = frames_;
+      bytes_ = 0;
+      frames_ = 0;
+    }
+    const double bps = bytes * 8.0 / dt;
+    fps_ = frames / dt;
+    if ((frames == 0) || (bytes == 0))
+    {
+      return true;
+    }
+    smoothed_bps_ = (smoothed_bps_ > 0.0) ? smoothed_bps_ + 0.3 * (bps - smoothed_bps_) : bps;
+
+    quality_ = std::max(min_quality, std::min(max_quality, quality_));
+    const double ratio = smoothed_bps_ / target_bps;
+    // jpeg size is far from linear in quality, steps of roughly ten per
+    // doubling of the error settle without much overshoot
+    const double doublings = std::abs(std::log(ratio) / std::log(2.0));
+    const int step = std::max(1, std::min(20, static_cast<int>(10.0 * doublings)));
+    if (ratio > 1.05)
+    {
+      if (quality_ > min_quality)
+      {
+        quality_ = std::max(min_quality, quality_ - step);
+      }
+      else
+      {
+        const float current = (rate_limit_ > 0.0) ? rate_limit_ : fps_;
+        rate_limit_ = std::max(0.5, current / ratio);
+      }
+    }
+    else if (ratio < 0.85)
+    {
+      if (rate_limit_ > 0.0)
+      {
+        // the renderer can not keep up with the limit anymore, drop it
+        if (fps_ < 0.8 * rate_limit_)
+        {
+          rate_limit_ = 0.0;
+        }
+        else
+        {
+          rate_limit_ *= std::min(1.25, 1.0 / ratio);
+        }
+      }
+      else if (quality_ < max_quality)
+      {
+        quality_ = std::min(max_quality, quality_ + std::min(step, 5));
+      }
+    }
+
+    boost::mutex::scoped_lock lock(request_->mutex);
+    if ((quality_ != request_->applied_quality) && !request_->call_in_flight)
+    {
+      // the service server is spun by the rviz thread, so don't block it
+      request_->call_in_flight = true;
+      boost::thread(boost::bind(&BandwidthController::setQuality, request_, quality_)).detach();
+    }
+    return true;
+  }
+
+  double achieved_bps() const
+  {
+    return smoothed_bps_;
+  }
+
+  double fps() const
+  {
+    return fps_;
+  }
+
+  int quality() const
+  {
+    return quality_;
+  }
+
+  // 0 when the frame rate is not limited
+  float rate_limit() const
+  {
+    return rate_limit_;
+  }
+};
+
+}  // namespace video_export
+
+
+namespace rviz
+{
+
+const QString CameraPub::BACKGROUND("background");
+const QString CameraPub::OVERLAY("overlay");
+const QString CameraPub::BOTH("background and overlay");
+
+std::vector<CameraPub*> CameraPub::instances_;
+int CameraPub::main_view_suspenders_ = 0;
+ros::WallTime CameraPub::last_main_view_render_;
+
+namespace
+{
+
+template<typename T>
+void addDiagnosticValue(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, const T& value)
+{
+  diagnostic_msgs::KeyValue kv;
+  kv.key = key;
+  std::ostringstream ss;
+  ss << value;
+  kv.value = ss.str();
+  status.values.push_back(kv);
+}
+
+// Add the projection of the bounds into the target in pixels to rect, false if
+// a corner is behind the camera and the projection is not meaningful
+bool projectBounds(const Ogre::AxisAlignedBox& bounds, const Ogre::Matrix4& view_projection,
+                   float width, float height, Ogre::Box& rect)
+{
+  if (bounds.isNull())
+    return true;
+  const Ogre::Vector3* corners = bounds.getAllCorners();
+  float min_x = width;
+  float min_y = height;
+  float max_x = 0.0;
+  float max_y = 0.0;
+  for (int i = 0; i < 8; ++i)
+  {
+    const Ogre::Vector4 clip = view_projection * Ogre::Vector4(corners[i].x, corners[i].y, corners[i].z, 1.0);
+    if (clip.w < 1e-6)
+      return false;
+    const float x = (clip.x / clip.w + 1.0) * 0.5 * width;
+    const float y = (1.0 - clip.y / clip.w) * 0.5 * height;
+    min_x = std::min(min_x, x);
+    min_y = std::min(min_y, y);
+    max_x = std::max(max_x, x);
+    max_y = std::max(max_y, y);
+  }
+  // a margin for rasterization and antialiasing
+  const int left = std::max(0.0f, std::floor(min_x) - 2);
+  const int top = std::max(0.0f, std::floor(min_y) - 2);
+  const int right = std::min(width, std::ceil(max_x) + 2);
+  const int bottom = std::min(height, std::ceil(max_y) + 2);
+  if ((left >= right) || (top >= bottom))
+    return true;
+  if ((rect.getWidth() == 0) || (rect.getHeight() == 0))
+  {
+    rect = Ogre::Box(left, top, right, bottom);
+    return true;
+  }
+  rect.left = std::min(static_cast<int>(rect.left), left);
+  rect.top = std::min(static_cast<int>(rect.top), top);
+  rect.right = std::max(static_cast<int>(rect.right), right);
+  rect.bottom = std::max(static_cast<int>(rect.bottom), bottom);
+  return true;
+}
+
+
+// Radical inverse of index in base, a low discrepancy sequence in [0, 1)
+float halton(int index, int base)
+{
+  float result = 0.0;
+  float f = 1.0;
+  while (index > 0)
+  {
+    f /= base;
+    result += f * (index % base);
+    index /= base;
+  }
+  return result;
+}
+
+
+// The intrinsics of the same camera at a resolution scaled by sx and sy
+void scaleCameraInfo(sensor_msgs::CameraInfo& info, double sx, double sy)
+{
+  info.width = static_cast<uint32_t>(info.width * sx + 0.5);
+  info.height = static_cast<uint32_t>(info.height * sy + 0.5);
+  info.K[0] *= sx;
+  info.K[2] *= sx;
+  info.K[4] *= sy;
+  info.K[5] *= sy;
+  info.P[0] *= sx;
+  info.P[2] *= sx;
+  info.P[3] *= sx;
+  info.P[5] *= sy;
+  info.P[6] *= sy;
+  info.P[7] *= sy;
+  info.roi = sensor_msgs::RegionOfInterest();
+}
+
+}  // namespace
+
+CameraPub::RenderStats::RenderStats()
+  : frames(0)
+  , triangles(0)
+  , batches(0)
+  , culled(0)
+  , render_ms(0.0)
+  , readback_ms(0.0)
+  , publish_ms(0.0)
+  , published(0)
+{
+}
+
+// the last triangle and batch counts, everything else averaged
+// over the reporting period
+void CameraPub::RenderStats::add(const ros::WallDuration& render, size_t triangle_count, size_t batch_count)
+{
+  ++frames;
+  triangles = triangle_count;
+  batches = batch_count;
+  render_ms += (render.toSec() * 1000.0 - render_ms) / frames;
+}
+
+void CameraPub::RenderStats::addPipeline(const ros::WallDuration& readback, const ros::WallDuration& publish)
+{
+  ++published;
+  readback_ms += (readback.toSec() * 1000.0 - readback_ms) / published;
+  publish_ms += (publish.toSec() * 1000.0 - publish_ms) / published;
+}
+
+bool validateFloats(const sensor_msgs::CameraInfo& msg)
+{
+  bool valid = true;
+  valid = valid && validateFloats(msg.D);
+  valid = valid && validateFloats(msg.K);
+  valid = valid && validateFloats(msg.R);
+  valid = valid && validateFloats(msg.P);
+  return valid;
+}
+
+CameraPub::CameraPub()
+  : Display()
+  , camera_trigger_name_("camera_trigger")
+  , nh_()
+  , standby_(false)
+  , standby_requested_(false)
+  , trigger_activated_(false)
+  , last_image_publication_time_(0)
+  , hq_trigger_activated_(false)
+  , burst_pf_(Ogre::PF_UNKNOWN)
+  , burst_captured_(0)
+  , burst_published_(0)
+  , latency_probe_(NULL)
+  , has_keyframe_(false)
+  , frame_due_(false)
+  , main_view_suspended_(false)
+  , partial_render_(false)
+  , dirty_region_checked_(false)
+  , frames_since_full_render_(0)
+  , retained_pf_(Ogre::PF_UNKNOWN)
+  , layer_compositor_(NULL)
+  , accumulation_samples_(0)
+  , accumulating_(false)
+  , lidar_(NULL)
+  , shm_step_(0)
+  , new_caminfo_(false)
+  , caminfo_ok_(false)
+  , force_render_(false)
+  , video_publisher_(0)
+  , hq_publisher_(0)
+  , multicast_oversized_(0)
+  , bandwidth_controller_(0)
+  , depth_render_texture_(NULL)
+{
+  topic_property_ = new RosTopicProperty("Image Topic", "",
+      QString::fromStdString(ros::message_traits::datatype<sensor_msgs::Image>()),
+      "sensor_msgs::Image topic to publish to.", this, SLOT(updateTopic()));
+
+  multicast_group_property_ = new StringProperty("Multicast Group", "",
+      "IPv4 multicast address to send every frame to as well, once for any number of receivers. "
+      "Empty disables it, see the multicast_image_receiver node.", this, SLOT(updateMulticast()));
+
+  multicast_port_property_ = new IntProperty("Port", 5004,
+      "UDP port of the multicast group.", multicast_group_property_, SLOT(updateMulticast()), this);
+  multicast_port_property_->setMin(1);
+  multicast_port_property_->setMax(65535);
+
+  multicast_ttl_property_ = new IntProperty("TTL", 1,
+      "Router hops the datagrams may take, 0 stays on this host and 1 on the local network.",
+      multicast_group_property_, SLOT(updateMulticast()), this);
+  multicast_ttl_property_->setMin(0);
+  multicast_ttl_property_->setMax(255);
+
+  multicast_interface_property_ = new StringProperty("Interface", "",
+      "Address of the interface to send from, empty for the default route.",
+      multicast_group_property_, SLOT(updateMulticast()), this);
+
+  multicast_fragment_size_property_ = new IntProperty("Fragment Size", 1452,
+      "Image bytes per datagram, with the 20 byte header it should fit into the network MTU.",
+      multicast_group_property_, SLOT(updateMulticast()), this);
+  multicast_fragment_size_property_->setMin(64);
+  multicast_fragment_size_property_->setMax(65000);
+
+  multicast_fec_group_property_ = new IntProperty("FEC Group", 8,
+      "Send one parity datagram per this many, which lets receivers rebuild one lost datagram "
+      "out of each group. 0 sends no parity.", multicast_group_property_, SLOT(updateMulticast()), this);
+  multicast_fec_group_property_->setMin(0);
+
+  gstreamer_pipeline_property_ = new StringProperty("GStreamer Pipeline", "",
+      "Also push every frame into this GStreamer pipeline, which starts after an appsrc, "
+      "e.g. \"videoconvert ! x264enc ! mp4mux ! filesink location=camera.mp4\". Empty disables it.",
+      this, SLOT(updateGstreamer()));
+
+  gstreamer_queue_property_ = new IntProperty("Max Queued Frames", 2,
+      "Frames are dropped while this many are waiting in the appsrc.", gstreamer_pipeline_property_,
+      SLOT(updateGstreamer()), this);
+  gstreamer_queue_property_->setMin(1);
+
+  burst_frames_property_ = new IntProperty("Burst Frames", 100,
+      "Number of frames the camera_trigger_burst service captures back to back into memory before "
+      "publishing them, memory for all of them is set aside when the service is called.", this);
+  burst_frames_property_->setMin(0);
+
+  hq_topic_property_ = new RosTopicProperty("High Quality Image Topic", "",
+      QString::fromStdString(ros::message_traits::datatype<sensor_msgs::Image>()),
+      "sensor_msgs::Image topic for stills requested through the camera_trigger_hq service, "
+      "rendered separately from the live stream with the settings below.", this, SLOT(updateTopic()));
+
+  hq_scale_property_ = new FloatProperty("Scale", 1.0,
+      "Resolution of the stills relative to the live stream, the camera info is scaled to match.",
+      hq_topic_property_);
+  hq_scale_property_->setMin(0.1);
+
+  hq_supersampling_property_ = new IntProperty("Supersampling", 2,
+      "Render at this many times the still resolution in each direction and average down.",
+      hq_topic_property_);
+  hq_supersampling_property_->setMin(1);
+  hq_supersampling_property_->setMax(4);
+
+  hq_lod_bias_property_ = new FloatProperty("LOD Bias", 100.0,
+      "Ogre level of detail bias for the stills, large values always use the most detailed mesh LOD.",
+      hq_topic_property_);
+  hq_lod_bias_property_->setMin(0.01);
+
+  namespace_property_ = new StringProperty("Display namespace", "",
+      "Namespace for this display.", this, SLOT(updateDisplayNamespace()));
+
+  camera_info_property_ = new RosTopicProperty("Camera Info Topic", "",
+      QString::fromStdString(ros::message_traits::datatype<sensor_msgs::CameraInfo>()),
+      "sensor_msgs::CameraInfo topic to subscribe to.", this, SLOT(updateTopic()));
+
+  queue_size_property_ = new IntProperty( "Queue Size", 2,
+      "Advanced: set the size of the incoming message queue.  Increasing this "
+      "is useful if your incoming TF data is delayed significantly from your"
+      " image data, but it can greatly increase memory usage if the messages are big.",
+                                          this, SLOT(updateQueueSize()));
+  queue_size_property_->setMin(1);
+
+  frame_rate_property_ = new FloatProperty("Frame Rate", -1,
+      "Sets target frame rate. Set to < 0 for maximum speed, set to 0 to stop, you can "
+      "trigger single images with the /rviz_camera_trigger service.",
+                                           this, SLOT(updateFrameRate()));
+  frame_rate_property_->setMin(-1);
+
+  keyframe_property_ = new BoolProperty("Keyframes Only", false,
+      "Only publish when the camera moved or turned more than the thresholds since the last "
+      "published frame, limited by the frame rate. Nothing is rendered in between.",
+      frame_rate_property_, SLOT(updateKeyframes()), this);
+
+  keyframe_translation_property_ = new FloatProperty("Translation", 0.1,
+      "Distance in meters the camera has to move to publish a new frame.", keyframe_property_);
+  keyframe_translation_property_->setMin(0.0);
+
+  keyframe_rotation_property_ = new FloatProperty("Rotation", 5.0,
+      "Angle in degrees the camera has to turn to publish a new frame.", keyframe_property_);
+  keyframe_rotation_property_->setMin(0.0);
+
+  keyframe_max_interval_property_ = new FloatProperty("Max Interval", 5.0,
+      "Publish a frame after this many seconds even if the camera did not move, 0 to disable.",
+      keyframe_property_);
+  keyframe_max_interval_property_->setMin(0.0);
+  updateKeyframes();
+
+  bandwidth_property_ = new FloatProperty("Bandwidth Target", 0.0,
+      "Target bit rate in kbit/s of the compressed image_transport stream. The jpeg quality and "
+      "if that is not enough the frame rate are adjusted to meet it. 0 to disable.",
+      this, SLOT(updateBandwidth()));
+  bandwidth_property_->setMin(0.0);
+
+  min_quality_property_ = new IntProperty("Min Quality", 20,
+      "Lowest jpeg quality, the frame rate is lowered beyond that.", bandwidth_property_);
+  min_quality_property_->setMin(1);
+  min_quality_property_->setMax(100);
+
+  max_quality_property_ = new IntProperty("Max Quality", 90,
+      "Highest jpeg quality the controller will use.", bandwidth_property_);
+  max_quality_property_->setMin(1);
+  max_quality_property_->setMax(100);
+
+  diagnostics_property_ = new BoolProperty("Publish Diagnostics", false,
+      "Publish the per render Ogre statistics and pipeline timings shown in the Render Stats "
+      "status on /diagnostics once a second.", this, SLOT(updateDiagnostics()));
+
+  frame_cache_size_property_ = new IntProperty("Frame Cache Size", 0,
+      "Keep this many of the last published frames for the camera_trigger_get_frame service, which returns "
+      "the frame nearest to a stamp or the two around it. 0 keeps none. Every frame stays in memory "
+      "as published.",
+      this, SLOT(updateFrameCache()), this);
+  frame_cache_size_property_->setMin(0);
+  frame_cache_size_property_->setMax(100);
+
+  frame_cache_age_property_ = new FloatProperty("Max Age", 2.0,
+      "Drop cached frames this many seconds older than the newest one, 0 for no limit.",
+      frame_cache_size_property_, SLOT(updateFrameCache()), this);
+  frame_cache_age_property_->setMin(0.0);
+
+  warm_standby_property_ = new BoolProperty("Warm Standby", false,
+      "When disabled only stop rendering, and keep the topics advertised, the camera info and "
+      "the camera pose so the display resumes right away when enabled again. Not with shared memory "
+      "input, the simulator would wait for the frames.",
+      this, SLOT(updateWarmStandby()), this);
+
+  latency_probe_property_ = new BoolProperty("Latency Probe", false,
+      "Benchmark how long a change in the scene takes to reach the published image. A small quad "
+      "in the top left corner of this camera flips between black and white and each published image "
+      "is checked for it. Share Render, Partial Render, Static Layer and Accumulate are off meanwhile.",
+      this, SLOT(updateLatencyProbe()), this);
+
+  probe_interval_property_ = new FloatProperty("Probe Interval", 0.5,
+      "Seconds between a flip being seen, or given up on, and the next flip.",
+      latency_probe_property_);
+  probe_interval_property_->setMin(0.0);
+
+  probe_timeout_property_ = new FloatProperty("Probe Timeout", 5.0,
+      "Seconds after which a flip that was not seen is counted as missed.",
+      latency_probe_property_);
+  probe_timeout_property_->setMin(0.1);
+
+  background_color_property_ = new ColorProperty("Background Color", Qt::black,
+      "Sets background color, values from 0.0 to 1.0.",
+                                           this, SLOT(updateBackgroundColor()));
+
+  image_encoding_property_ = new EnumProperty("Image Encoding", "rgb8",
+      "Sets the image encoding", this, SLOT(updateImageEncoding()));
+  image_encoding_property_->addOption("rgb8", 0);
+  image_encoding_property_->addOption("rgba8", 1);
+  image_encoding_property_->addOption("bgr8", 2);
+  image_encoding_property_->addOption("bgra8", 3);
+  image_encoding_property_->addOption("mono8", 4);
+  image_encoding_property_->addOption("mono16", 5);
+
+  near_clip_property_ = new FloatProperty("Near Clip Distance", 0.01, "Set the near clip distance",
+      this, SLOT(updateNearClipDistance()));
+  near_clip_property_->setMin(0.01);
+
+  frustum_culling_property_ = new BoolProperty("Frustum Culling", false,
+      "Before each render, hide displays whose bounding box is outside the camera view.", this);
+
+  share_render_property_ = new BoolProperty("Share Render", true,
+      "If another display renders the same camera with the same view settings and visible "
+      "displays, render and read back only once and do just the conversion and publishing here.",
+      this);
+
+  suspend_main_view_property_ = new BoolProperty("Suspend Main View", false,
+      "Stop rendering the main 3D view while this display is enabled, leaving the render budget to the "
+      "camera displays. Setting the ~camera_only parameter of rviz does the same for every camera display.",
+      this, SLOT(updateMainView()), this);
+
+  main_view_rate_property_ = new FloatProperty("Main View Rate", 1.0,
+      "Redraw the suspended main view at this rate in Hz, 0 leaves it as it is.",
+      suspend_main_view_property_, SLOT(updateMainView()), this);
+  main_view_rate_property_->setMin(0.0);
+
+  partial_render_property_ = new BoolProperty("Partial Render", false,
+      "Only render and read back the part of the image covered by displays whose bounds changed, "
+      "the rest is kept from the previous frame. Changes inside unchanged bounds are missed "
+      "until the next full render.", this);
+
+  full_render_interval_property_ = new IntProperty("Full Render Interval", 30,
+      "Render the whole image at least every this many frames, 0 only renders it when the view changes.",
+      partial_render_property_);
+  full_render_interval_property_->setMin(0);
+
+  static_layer_property_ = new BoolProperty("Static Layer", false,
+      "Render the displays marked as static once and keep them, only the other displays are "
+      "rendered every frame and drawn over them where they are closer. Meant for cameras that "
+      "do not move, transparent dynamic displays hide what is behind them.", this);
+
+  static_refresh_property_ = new FloatProperty("Static Refresh Interval", 0.0,
+      "Render the static displays again after this many seconds, for content that changes without "
+      "moving like map updates. 0 only renders them again when the view or their bounds change.",
+      static_layer_property_);
+  static_refresh_property_->setMin(0.0);
+
+  accumulate_property_ = new BoolProperty("Accumulate", false,
+      "While the view and the bounds of all displays stay the same, average renders shifted by "
+      "sub pixel offsets for antialiasing, and stop rendering once enough samples are averaged.", this);
+
+  accumulation_samples_property_ = new IntProperty("Accumulation Samples", 16,
+      "Number of renders averaged into a converged frame.", accumulate_property_);
+  accumulation_samples_property_->setMin(1);
+  accumulation_samples_property_->setMax(256);
+
+  accumulation_refresh_property_ = new FloatProperty("Accumulation Refresh Interval", 1.0,
+      "Start accumulating again after this many seconds, to pick up changes that keep the bounds of "
+      "all displays the same, like marker colours, point cloud contents, map updates or text. "
+      "0 keeps a converged frame until the view or the bounds change.", accumulate_property_);
+  accumulation_refresh_property_->setMin(0.0);
+
+  projection_property_ = new EnumProperty("Projection", "Perspective",
+      "Perspective uses the projection from CameraInfo P, Orthographic renders a top down "
+      "view of the scene and does not need a CameraInfo.", this, SLOT(updateProjection()));
+  projection_property_->addOption("Perspective", PROJECTION_PERSPECTIVE);
+  projection_property_->addOption("Orthographic", PROJECTION_ORTHOGRAPHIC);
+  projection_property_->addOption("Lidar", PROJECTION_LIDAR);
+
+  ortho_frame_property_ = new TfFrameProperty("Frame", TfFrameProperty::FIXED_FRAME_STRING,
+      "The orthographic camera looks down the -Z axis of this frame, image x along +X and up along +Y.",
+      projection_property_, NULL, true);
+
+  ortho_resolution_property_ = new FloatProperty("Meters Per Pixel", 0.05,
+      "Size of one output pixel in meters.", projection_property_, SLOT(updateProjection()), this);
+  ortho_resolution_property_->setMin(0.0001);
+
+  ortho_width_property_ = new FloatProperty("Width", 20.0,
+      "Extent of the image along the frame X axis in meters.", projection_property_, SLOT(updateProjection()), this);
+  ortho_width_property_->setMin(0.0001);
+
+  ortho_height_property_ = new FloatProperty("Height", 20.0,
+      "Extent of the image along the frame Y axis in meters.", projection_property_, SLOT(updateProjection()), this);
+  ortho_height_property_->setMin(0.0001);
+
+  ortho_altitude_property_ = new FloatProperty("Altitude", 50.0,
+      "Height of the camera above the frame origin, anything higher is clipped. "
+      "The far plane is placed the same distance below the origin.",
+      projection_property_, SLOT(updateProjection()), this);
+  ortho_altitude_property_->setMin(0.01);
+
+  publish_height_property_ = new BoolProperty("Publish Height", false,
+      "Also render the scene depth and publish it as a 32FC1 height above the frame origin, "
+      "NaN where nothing was rendered.", projection_property_, SLOT(updateProjection()), this);
+
+  height_topic_property_ = new RosTopicProperty("Height Topic", "",
+      QString::fromStdString(ros::message_traits::datatype<sensor_msgs::Image>()),
+      "sensor_msgs::Image topic to publish the height channel to.", projection_property_,
+      SLOT(updateTopic()), this);
+
+  input_property_ = new EnumProperty("Input", "ROS",
+      "Where the camera intrinsics and pose come from. ROS uses the CameraInfo topic and TF, "
+      "Shared Memory reads them from a region written by a simulator and renders one frame per "
+      "simulator step. Only used with the perspective projection.", this, SLOT(updateInput()));
+  input_property_->addOption("ROS", INPUT_ROS);
+  input_property_->addOption("Shared Memory", INPUT_SHARED_MEMORY);
+
+  shm_name_property_ = new StringProperty("Shared Memory Name", "rviz_camera_stream",
+      "Name of the shared memory region created by the simulator.", input_property_,
+      SLOT(updateInput()), this);
+
+  strip_rows_property_ = new IntProperty("Strip Rows", 0,
+      "Publish each frame as a sequence of images this many rows high, with the CameraInfo roi "
+      "giving the position of the strip in the frame. Lowers the latency to the first rows for "
+      "large images. 0 publishes whole frames.", this);
+  strip_rows_property_->setMin(0);
+
+  threaded_publishing_property_ = new BoolProperty("Threaded Publishing", false,
+      "Only render and read back on the rviz thread, convert to the output encoding and "
+      "publish on a separate thread. Frames the publish thread can not keep up with are dropped, "
+      "the render rate still depends on how busy the rviz thread is. "
+      "Not used with shared memory input, where every step has to be published.",
+      this, SLOT(updateThreadedPublishing()));
+
+  lidar_frame_property_ = new TfFrameProperty("Sensor Frame", TfFrameProperty::FIXED_FRAME_STRING,
+      "Frame of the simulated lidar, x forward and z up.", projection_property_, NULL, true);
+
+  lidar_faces_property_ = new EnumProperty("Faces", "6",
+      "Number of 90 degree depth views rendered per scan, 4 only covers +-45 degrees of elevation.",
+      projection_property_, SLOT(updateLidar()), this);
+  lidar_faces_property_->addOption("4", 4);
+  lidar_faces_property_->addOption("6", 6);
+
+  lidar_resolution_property_ = new IntProperty("Face Resolution", 512,
+      "Width and height of every depth view in pixels.", projection_property_, SLOT(updateLidar()), this);
+  lidar_resolution_property_->setMin(16);
+
+  lidar_rings_property_ = new IntProperty("Rings", 16,
+      "Number of rings when no beam table is given.", projection_property_, SLOT(updateLidar()), this);
+  lidar_rings_property_->setMin(1);
+
+  lidar_min_elevation_property_ = new FloatProperty("Min Elevation", -15.0,
+      "Elevation of the lowest ring in degrees.", projection_property_, SLOT(updateLidar()), this);
+
+  lidar_max_elevation_property_ = new FloatProperty("Max Elevation", 15.0,
+      "Elevation of the highest ring in degrees.", projection_property_, SLOT(updateLidar()), this);
+
+  lidar_samples_property_ = new IntProperty("Horizontal Samples", 1024,
+      "Beams per ring, evenly spread over 360 degrees.", projection_property_, SLOT(updateLidar()), this);
+  lidar_samples_property_->setMin(1);
+
+  lidar_beam_table_property_ = new StringProperty("Beam Table", "",
+      "Optional file with one beam per line: ring elevation azimuth, angles in degrees. "
+      "Replaces the rings and samples above.", projection_property_, SLOT(updateLidar()), this);
+
+  lidar_min_range_property_ = new FloatProperty("Min Range", 0.3,
+      "Returns closer than this are dropped.", projection_property_, SLOT(updateLidar()), this);
+  lidar_min_range_property_->setMin(0.01);
+
+  lidar_max_range_property_ = new FloatProperty("Max Range", 100.0,
+      "Returns further than this are dropped.", projection_property_, SLOT(updateLidar()), this);
+  lidar_max_range_property_->setMin(0.1);
+
+  cloud_topic_property_ = new RosTopicProperty("Point Cloud Topic", "",
+      QString::fromStdString(ros::message_traits::datatype<sensor_msgs::PointCloud2>()),
+      "sensor_msgs::PointCloud2 topic to publish the lidar scans to.", projection_property_,
+      SLOT(updateTopic()), this);
+
+  updateProjection();
+  updateLidar();
+  updateInput();
+}
 
 CameraPub::~CameraPub()
 {
@@ -264,9 +1433,28 @@ CameraPub::~CameraPub()
     render_texture_->removeListener(this);
 
     unsubscribe();
+    updateGstreamer();
+    setMainViewSuspended(false);
 
     context_->visibilityBits()->freeBits(vis_bit_);
+    context_->visibilityBits()->freeBits(static_vis_bit_);
+    instances_.erase(std::remove(instances_.begin(), instances_.end(), this), instances_.end());
+    delete lidar_;
+    delete layer_compositor_;
+    video_publisher_->setProbe(NULL);
+    delete latency_probe_;
+    if (!hq_texture_.isNull())
+    {
+      Ogre::TextureManager::getSingleton().remove(hq_texture_->getName());
+    }
+    if (!depth_texture_.isNull())
+    {
+      Ogre::TextureManager::getSingleton().remove(depth_texture_->getName());
+    }
   }
+  delete bandwidth_controller_;
+  delete video_publisher_;
+  delete hq_publisher_;
 }
 
 bool CameraPub::triggerCallback(std_srvs::TriggerRequest& req, std_srvs::TriggerResponse& res)
@@ -284,43 +1472,98 @@ bool CameraPub::triggerCallback(std_srvs::TriggerRequest& req, std_srvs::Trigger
   return true;
 }
 
+bool CameraPub::hqTriggerCallback(std_srvs::TriggerRequest& req, std_srvs::TriggerResponse& res)
+{
+  res.success = hq_publisher_->is_active();
+  if (res.success)
+  {
+    hq_trigger_activated_ = true;
+    res.message = "New high quality image will be published on: " + hq_publisher_->get_topic();
+  }
+  else
+  {
+    res.message = "High quality image publisher not configured";
+  }
+  return true;
+}
+
+// Set aside the buffers for a burst, capturing starts with the next update
+bool CameraPub::burstCallback(std_srvs::TriggerRequest& req, std_srvs::TriggerResponse& res)
+{
+  const int frames = burst_frames_property_->getInt();
+  res.success = false;
+  if (!video_publisher_->is_active())
+  {
+    res.message = "Image publisher not configured";
+  }
+  else if (isLidar())
+  {
+    res.message = "Bursts are not available in lidar mode";
+  }
+  else if (frames <= 0)
+  {
+    res.message = "Burst Frames is 0";
+  }
+  else if (!burst_frames_.empty())
+  {
+    res.message = "A burst is still being captured or published";
+  }
+  else
+  {
+    const int width = render_texture_->getWidth();
+    const int height = render_texture_->getHeight();
+    burst_pf_ = render_texture_->suggestPixelFormat();
+    const size_t frame_size = Ogre::PixelUtil::getMemorySize(width, height, 1, burst_pf_);
+    burst_frames_.resize(frames);
+    for (size_t i = 0; i < burst_frames_.size(); ++i)
+    {
+      burst_frames_[i].native.reset(new sensor_msgs::Image);
+      burst_frames_[i].native->width = width;
+      burst_frames_[i].native->height = height;
+      burst_frames_[i].native->is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+      burst_frames_[i].native->data.resize(frame_size);
+    }
+    burst_captured_ = 0;
+    burst_published_ = 0;
+    res.success = true;
+    std::ostringstream ss;
+    ss << "Capturing " << frames << " frames into " << frames * frame_size / (1024 * 1024) << " MB, then publishing on "
+       << video_publisher_->get_topic();
+    res.message = ss.str();
+  }
+  return true;
+}
+
 void CameraPub::onInitialize()
 {
   Display::onInitialize();
 
   video_publisher_ = new video_export::VideoPublisher();
+  hq_publisher_ = new video_export::VideoPublisher();
+  bandwidth_controller_ = new video_export::BandwidthController();
+  updateThreadedPublishing();
+  updateFrameCache();
 
   std::stringstream ss;
   static int count = 0;
   ss << "RvizCameraPubCamera" << count++;
   camera_ = context_->getSceneManager()->createCamera(ss.str());
 
+  // Thought this was optional but the plugin crashes without it
+  vis_bit_ = context_->visibilityBits()->allocBit();
+
   // render to texture
-  rtt_texture_ = Ogre::TextureManager::getSingleton().createManual(
-      "RttTex",
-      Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
-      Ogre::TEX_TYPE_2D,
-      640, 480,
-      0,
-      Ogre::PF_R8G8B8,
-      Ogre::TU_RENDERTARGET);
+  rtt_texture_ = createRenderTexture(640, 480);
   render_texture_ = rtt_texture_->getBuffer()->getRenderTarget();
-  render_texture_->addViewport(camera_);
-  render_texture_->getViewport(0)->setClearEveryFrame(true);
-  render_texture_->getViewport(0)->setBackgroundColour(Ogre::ColourValue::Black);
-  render_texture_->getViewport(0)->setOverlaysEnabled(false);
-  render_texture_->setAutoUpdated(false);
-  render_texture_->setActive(false);
   render_texture_->addListener(this);
 
+  ortho_frame_property_->setFrameManager(context_->getFrameManager());
+  lidar_frame_property_->setFrameManager(context_->getFrameManager());
+
   camera_->setNearClipDistance(0.01f);
   camera_->setPosition(0, 10, 15);
   camera_->lookAt(0, 0, 0);
 
-  // Thought this was optional but the plugin crashes without it
-  vis_bit_ = context_->visibilityBits()->allocBit();
-  render_texture_->getViewport(0)->setVisibilityMask(vis_bit_);
-
   visibility_property_ = new DisplayGroupVisibilityProperty(
     vis_bit_, context_->getRootDisplayGroup(), this, "Visibility", true,
     "Changes the visibility of other Displays in the camera view.");
@@ -328,144 +1571,1597 @@ void CameraPub::onInitialize()
   visibility_property_->setIcon(loadPixmap("package://rviz/icons/visibility.svg", true));
 
   this->addChild(visibility_property_, 0);
+
+  static_vis_bit_ = context_->visibilityBits()->allocBit();
+  static_visibility_property_ = new DisplayGroupVisibilityProperty(
+    static_vis_bit_, context_->getRootDisplayGroup(), this, "Static Displays", false,
+    "Displays that do not change and are kept in the static layer.", static_layer_property_);
+  layer_compositor_ = new rviz_camera_stream::LayerCompositor(camera_, vis_bit_);
+  latency_probe_ = new rviz_camera_stream::LatencyProbe(context_->getSceneManager(), vis_bit_);
+
+  lidar_ = new rviz_camera_stream::DepthLidar(context_->getSceneManager(), vis_bit_);
+
+  instances_.push_back(this);
   updateDisplayNamespace();
 }
 
-void CameraPub::updateTopic()
+void CameraPub::updateTopic()
+{
+  unsubscribe();
+  reset();
+  subscribe();
+  context_->queueRender();
+}
+
+void CameraPub::preRenderTargetUpdate(const Ogre::RenderTargetEvent& evt)
+{
+  // set view flags on all displays
+  visibility_property_->update();
+  if (frustum_culling_property_->getBool())
+  {
+    // the scene graph is only updated once the viewport renders
+    updateSceneBounds();
+    cullDisplays(context_->getRootDisplayGroup());
+  }
+  render_start_ = ros::WallTime::now();
+}
+
+// Clear our visibility bit on displays whose bounds are entirely outside the
+// camera frustum, so Ogre does not walk their objects at all.
+// Displays without bounds are left alone, they may draw through nodes that
+// are not below their own scene node.
+void CameraPub::cullDisplays(DisplayGroup* group)
+{
+  for (int i = 0; i < group->numDisplays(); ++i)
+  {
+    Display* display = group->getDisplayAt(i);
+    if (!display->isEnabled() || (display == this))
+      continue;
+    DisplayGroup* child_group = qobject_cast<DisplayGroup*>(display);
+    if (child_group)
+    {
+      cullDisplays(child_group);
+      continue;
+    }
+    if (!(display->getVisibilityBits() & vis_bit_))
+      continue;
+    Ogre::SceneNode* node = display->getSceneNode();
+    if (!node)
+      continue;
+    const Ogre::AxisAlignedBox& bounds = node->_getWorldAABB();
+    if (bounds.isNull() || bounds.isInfinite())
+      continue;
+    if (camera_->isVisible(bounds))
+      continue;
+    display->unsetVisibilityBits(vis_bit_);
+    culled_displays_.push_back(display);
+  }
+}
+
+void CameraPub::postRenderTargetUpdate(const Ogre::RenderTargetEvent& evt)
+{
+  for (size_t i = 0; i < culled_displays_.size(); ++i)
+  {
+    culled_displays_[i]->setVisibilityBits(vis_bit_);
+  }
+  render_stats_.culled = culled_displays_.size();
+  culled_displays_.clear();
+
+  // triangle and batch counts are complete once the viewport is updated,
+  // the gpu may still be busy with it which shows up in the readback time
+  render_stats_.add(ros::WallTime::now() - render_start_,
+                    render_texture_->getTriangleCount(), render_texture_->getBatchCount());
+
+  // one readback for this display and all that share its render
+  sensor_msgs::ImagePtr native;
+  Ogre::PixelFormat native_pf = Ogre::PF_UNKNOWN;
+  if (!shared_followers_.empty())
+  {
+    native = video_publisher_->readNative(render_texture_, native_pf);
+    for (size_t i = 0; i < shared_followers_.size(); ++i)
+    {
+      shared_followers_[i]->publishSharedFrame(native, native_pf);
+    }
+    shared_followers_.clear();
+  }
+
+  if (!frame_due_ || accumulating_)
+    return;
+
+  publishTarget(native, native_pf);
+}
+
+// Publish the rendered window video stream,
+// update() only renders when isFrameDue() says so
+void CameraPub::publishTarget(const sensor_msgs::ImageConstPtr& native, Ogre::PixelFormat native_pf)
+{
+  const ros::Time cur_time = ros::Time::now();
+  trigger_activated_ = false;
+  last_image_publication_time_ = cur_time;
+  render_texture_->getViewport(0)->setBackgroundColour(background_color_property_->getOgreColor());
+
+  std::string frame_id;
+  if (!prepareCameraInfo(frame_id))
+    return;
+
+  int encoding_option = image_encoding_property_->getOptionInt();
+
+  const int strip_rows = strip_rows_property_->getInt();
+
+  // render_texture_->update();
+  if (native)
+  {
+    if (!video_publisher_->publishNative(native, native_pf, frame_id, encoding_option))
+      return;
+  }
+  else if (partial_render_property_->getBool() && (strip_rows <= 0))
+  {
+    // the last published frame outside of the dirty region is still valid
+    const Ogre::Box region = partial_render_ ? dirty_region_ :
+        Ogre::Box(0, 0, render_texture_->getWidth(), render_texture_->getHeight());
+    video_publisher_->readRegion(rtt_texture_->getBuffer(), region, retained_frame_, retained_pf_);
+    if (!video_publisher_->publishNative(retained_frame_, retained_pf_, frame_id, encoding_option))
+      return;
+  }
+  else if (strip_rows > 0)
+  {
+    if (!video_publisher_->publishStrips(render_texture_, frame_id, encoding_option, strip_rows))
+      return;
+  }
+  else if (!video_publisher_->publishFrame(render_texture_, frame_id, encoding_option))
+  {
+    return;
+  }
+
+  framePublished();
+
+  if (isOrthographic() && publish_height_property_->getBool())
+  {
+    publishHeight(video_publisher_->camera_info_.header);
+  }
+}
+
+// Render the static displays once into a cached layer and only the dynamic
+// ones every frame over it, then publish the result.
+// The static layer is rendered again when the view, the background or the
+// set and bounds of the static displays change, or after the refresh interval.
+void CameraPub::renderLayers()
+{
+  const ros::WallTime start = ros::WallTime::now();
+  layer_compositor_->resize(render_texture_->getWidth(), render_texture_->getHeight());
+
+  // set view flags on all displays, the layers are split below
+  visibility_property_->update();
+  static_visibility_property_->update();
+  std::vector<Display*> displays;
+  collectVisibleDisplays(context_->getRootDisplayGroup(), displays);
+  updateSceneBounds();
+  std::vector<Display*> static_displays;
+  std::vector<Display*> dynamic_displays;
+  std::map<Display*, Ogre::AxisAlignedBox> static_bounds;
+  for (size_t i = 0; i < displays.size(); ++i)
+  {
+    if (displays[i] == this)
+      continue;
+    if (!(displays[i]->getVisibilityBits() & static_vis_bit_))
+    {
+      dynamic_displays.push_back(displays[i]);
+      continue;
+    }
+    static_displays.push_back(displays[i]);
+    Ogre::SceneNode* node = displays[i]->getSceneNode();
+    static_bounds[displays[i]] = node ? node->_getWorldAABB() : Ogre::AxisAlignedBox();
+  }
+
+  const Ogre::Matrix4 view_projection = camera_->getProjectionMatrix() * camera_->getViewMatrix();
+  const Ogre::ColourValue background = background_color_property_->getOgreColor();
+  const float refresh_interval = static_refresh_property_->getFloat();
+  if (!layer_compositor_->hasStaticLayer() || (view_projection != static_view_projection_) ||
+      (background != static_background_) || (static_bounds != static_bounds_) ||
+      ((refresh_interval > 0.0) && ((start - last_static_render_).toSec() >= refresh_interval)))
+  {
+    setDisplaysVisible(dynamic_displays, false);
+    layer_compositor_->renderStatic(background);
+    setDisplaysVisible(dynamic_displays, true);
+    static_view_projection_ = view_projection;
+    static_background_ = background;
+    static_bounds_.swap(static_bounds);
+    last_static_render_ = start;
+  }
+  setStatus(StatusProperty::Ok, "Static Layer",
+            QString::number(static_displays.size()) + " static displays cached, " +
+            QString::number(dynamic_displays.size()) + " dynamic displays rendered every frame");
+
+  setDisplaysVisible(static_displays, false);
+  // the publish thread may still be converting the last frame
+  if (!layer_frame_ || !layer_frame_.unique())
+  {
+    layer_frame_.reset(new sensor_msgs::Image);
+  }
+  layer_compositor_->renderDynamic(*layer_frame_);
+  setDisplaysVisible(static_displays, true);
+  layer_frame_->header.stamp = ros::Time::now();
+
+  render_stats_.add(ros::WallTime::now() - start, layer_compositor_->triangleCount(),
+                    layer_compositor_->batchCount());
+  publishTarget(layer_frame_, Ogre::PF_BYTE_RGB);
+}
+
+void CameraPub::setDisplaysVisible(const std::vector<Display*>& displays, bool visible)
+{
+  for (size_t i = 0; i < displays.size(); ++i)
+  {
+    if (visible)
+    {
+      displays[i]->setVisibilityBits(vis_bit_);
+    }
+    else
+    {
+      displays[i]->unsetVisibilityBits(vis_bit_);
+    }
+  }
+}
+
+// Ogre brings the world bounds of the scene nodes up to date only while
+// rendering, so outside of a render they are where the nodes were for the
+// last one. Displays move their nodes in update(), which runs before that.
+void CameraPub::updateSceneBounds()
+{
+  context_->getSceneManager()->getRootSceneNode()->_update(true, false);
+}
+
+// World bounds of the scene nodes of all displays visible in the camera,
+// false if one of them is infinite
+bool CameraPub::collectDisplayBounds(std::map<Display*, Ogre::AxisAlignedBox>& bounds)
+{
+  updateSceneBounds();
+  std::vector<Display*> displays;
+  collectVisibleDisplays(context_->getRootDisplayGroup(), displays);
+  bool bounded = true;
+  for (size_t i = 0; i < displays.size(); ++i)
+  {
+    if (displays[i] == this)
+      continue;
+    Ogre::SceneNode* node = displays[i]->getSceneNode();
+    if (!node)
+      continue;
+    bounds[displays[i]] = node->_getWorldAABB();
+    bounded = bounded && !node->_getWorldAABB().isInfinite();
+  }
+  return bounded;
+}
+
+// While neither the view nor the bounds of any display change, every frame
+// renders the same view shifted by a different sub pixel offset and adds it
+// to a running average, which is published. Once the configured number of
+// samples is reached nothing is rendered anymore, the converged frame is
+// published again when a frame is due until the refresh interval is up.
+void CameraPub::renderAccumulated()
+{
+  const ros::WallTime now = ros::WallTime::now();
+  const float refresh_interval = accumulation_refresh_property_->getFloat();
+  // set view flags on all displays, as preRenderTargetUpdate() will
+  visibility_property_->update();
+  std::map<Display*, Ogre::AxisAlignedBox> bounds;
+  const bool bounded = collectDisplayBounds(bounds);
+
+  const int width = render_texture_->getWidth();
+  const int height = render_texture_->getHeight();
+  const Ogre::Matrix4 view_projection = camera_->getProjectionMatrix() * camera_->getViewMatrix();
+  const Ogre::ColourValue background = background_color_property_->getOgreColor();
+  if (!bounded || !accumulation_frame_ || (accumulation_frame_->width != width) ||
+      (accumulation_frame_->height != height) || (view_projection != accumulation_view_projection_) ||
+      (background != accumulation_background_) || (bounds != accumulation_bounds_) ||
+      ((refresh_interval > 0.0) && ((now - accumulation_start_).toSec() >= refresh_interval)))
+  {
+    accumulation_start_ = now;
+    accumulation_samples_ = 0;
+    accumulation_.assign(width * height * 3, 0);
+    accumulation_view_projection_ = view_projection;
+    accumulation_background_ = background;
+    accumulation_bounds_.swap(bounds);
+  }
+
+  // the publish thread may still be converting the last frame
+  if (!accumulation_frame_ || !accumulation_frame_.unique())
+  {
+    accumulation_frame_.reset(accumulation_frame_ ? new sensor_msgs::Image(*accumulation_frame_) :
+                              new sensor_msgs::Image);
+  }
+  sensor_msgs::Image& frame = *accumulation_frame_;
+
+  const int samples = accumulation_samples_property_->getInt();
+  if (static_cast<int>(accumulation_samples_) >= samples)
+  {
+    setStatus(StatusProperty::Ok, "Accumulation", "Converged after " + QString::number(accumulation_samples_) +
+              " samples, not rendering");
+    frame.header.stamp = ros::Time::now();
+    publishTarget(accumulation_frame_, Ogre::PF_BYTE_RGB);
+    return;
+  }
+
+  // the first sample is not shifted, so a view that keeps changing looks as without accumulation
+  const float dx = (accumulation_samples_ == 0) ? 0.0 : halton(accumulation_samples_, 2) - 0.5;
+  const float dy = (accumulation_samples_ == 0) ? 0.0 : halton(accumulation_samples_, 3) - 0.5;
+  Ogre::Matrix4 jitter = Ogre::Matrix4::IDENTITY;
+  jitter[0][3] = 2.0 * dx / width;
+  jitter[1][3] = -2.0 * dy / height;
+  const bool custom_projection = camera_->isCustomProjectionMatrixEnabled();
+  const Ogre::Matrix4 projection = camera_->getProjectionMatrix();
+  camera_->setCustomProjectionMatrix(true, jitter * projection);
+  // postRenderTargetUpdate() leaves the publishing to us
+  accumulating_ = true;
+  render_texture_->getViewport(0)->setBackgroundColour(background);
+  render_texture_->update();
+  accumulating_ = false;
+  camera_->setCustomProjectionMatrix(custom_projection, projection);
+
+  accumulation_readback_.resize(width * height * 3);
+  Ogre::PixelBox pb(width, height, 1, Ogre::PF_BYTE_RGB, &accumulation_readback_[0]);
+  render_texture_->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+  ++accumulation_samples_;
+
+  frame.height = height;
+  frame.width = width;
+  frame.step = width * 3;
+  frame.is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+  frame.data.resize(accumulation_.size());
+  const uint32_t half = accumulation_samples_ / 2;
+  for (size_t i = 0; i < accumulation_.size(); ++i)
+  {
+    accumulation_[i] += accumulation_readback_[i];
+    frame.data[i] = (accumulation_[i] + half) / accumulation_samples_;
+  }
+  frame.header.stamp = ros::Time::now();
+
+  setStatus(StatusProperty::Ok, "Accumulation", QString::number(accumulation_samples_) + " of " +
+            QString::number(samples) + " samples");
+  publishTarget(accumulation_frame_, Ogre::PF_BYTE_RGB);
+}
+
+// Find the part of the target that changed since the last render: the old
+// and new bounds of every display whose bounds moved, appeared or went away.
+// Returns false when the whole target has to be rendered, because the view
+// changed, something is unbounded or most of the image is dirty anyway.
+// Changes that keep the bounds of a display the same are only picked up by
+// the periodic full render.
+bool CameraPub::findDirtyRegion(Ogre::Box& region)
+{
+  std::map<Display*, Ogre::AxisAlignedBox> bounds;
+  const bool unbounded = !collectDisplayBounds(bounds);
+  std::map<Display*, Ogre::AxisAlignedBox> previous;
+  previous.swap(display_bounds_);
+  display_bounds_ = bounds;
+  dirty_region_checked_ = true;
+
+  const float width = render_texture_->getWidth();
+  const float height = render_texture_->getHeight();
+  const Ogre::Matrix4 view_projection = camera_->getProjectionMatrix() * camera_->getViewMatrix();
+  const Ogre::ColourValue background = render_texture_->getViewport(0)->getBackgroundColour();
+  const int full_render_interval = full_render_interval_property_->getInt();
+  const bool same_view = retained_frame_ && (retained_frame_->width == width) &&
+      (retained_frame_->height == height) && (view_projection == retained_view_projection_) &&
+      (background == retained_background_) &&
+      ((full_render_interval <= 0) || (frames_since_full_render_ < full_render_interval));
+  retained_view_projection_ = view_projection;
+  retained_background_ = background;
+
+  region = Ogre::Box(0, 0, 0, 0);
+  bool projected = same_view && !unbounded;
+  std::map<Display*, Ogre::AxisAlignedBox>::const_iterator it;
+  for (it = bounds.begin(); (it != bounds.end()) && projected; ++it)
+  {
+    std::map<Display*, Ogre::AxisAlignedBox>::iterator old = previous.find(it->first);
+    if ((old != previous.end()) && (old->second == it->second))
+    {
+      previous.erase(old);
+      continue;
+    }
+    projected = projectBounds(it->second, view_projection, width, height, region);
+    if (old != previous.end())
+    {
+      projected = projected && projectBounds(old->second, view_projection, width, height, region);
+      previous.erase(old);
+    }
+  }
+  // displays that were hidden or removed since the last render
+  for (it = previous.begin(); (it != previous.end()) && projected; ++it)
+  {
+    projected = projectBounds(it->second, view_projection, width, height, region);
+  }
+
+  if (!projected || (2 * region.getWidth() * region.getHeight() > width * height))
+  {
+    frames_since_full_render_ = 0;
+    return false;
+  }
+  ++frames_since_full_render_;
+  return true;
+}
+
+// Render only region of the target, the rest keeps the previous frame.
+// The viewport is shrunk to the region, which also limits the clear to it,
+// and the projection is cropped so the viewport shows its part of the full view.
+void CameraPub::renderRegion(Ogre::Box& region)
+{
+  Ogre::Viewport* viewport = render_texture_->getViewport(0);
+  const double width = render_texture_->getWidth();
+  const double height = render_texture_->getHeight();
+  viewport->setDimensions(region.left / width, region.top / height,
+                          region.getWidth() / width, region.getHeight() / height);
+  // the viewport may round to other pixels than asked for
+  region = Ogre::Box(viewport->getActualLeft(), viewport->getActualTop(),
+                     viewport->getActualLeft() + viewport->getActualWidth(),
+                     viewport->getActualTop() + viewport->getActualHeight());
+
+  const double x0 = 2.0 * region.left / width - 1.0;
+  const double x1 = 2.0 * region.right / width - 1.0;
+  const double y0 = 1.0 - 2.0 * region.bottom / height;
+  const double y1 = 1.0 - 2.0 * region.top / height;
+  Ogre::Matrix4 crop = Ogre::Matrix4::IDENTITY;
+  crop[0][0] = 2.0 / (x1 - x0);
+  crop[0][3] = -(x1 + x0) / (x1 - x0);
+  crop[1][1] = 2.0 / (y1 - y0);
+  crop[1][3] = -(y1 + y0) / (y1 - y0);
+
+  const bool custom_projection = camera_->isCustomProjectionMatrixEnabled();
+  const Ogre::Matrix4 projection = camera_->getProjectionMatrix();
+  camera_->setCustomProjectionMatrix(true, crop * projection);
+  render_texture_->update();
+  camera_->setCustomProjectionMatrix(custom_projection, projection);
+  viewport->setDimensions(0.0, 0.0, 1.0, 1.0);
+}
+
+bool CameraPub::prepareCameraInfo(std::string& frame_id)
+{
+  if (isOrthographic())
+  {
+    if (!caminfo_ok_)
+      return false;
+    frame_id = ortho_caminfo_.header.frame_id;
+    video_publisher_->camera_info_ = ortho_caminfo_;
+    return true;
+  }
+
+  boost::mutex::scoped_lock lock(caminfo_mutex_);
+  if (!current_caminfo_)
+    return false;
+  frame_id = current_caminfo_->header.frame_id;
+  video_publisher_->camera_info_ = *current_caminfo_;
+  return true;
+}
+
+void CameraPub::framePublished()
+{
+  render_stats_.addPipeline(video_publisher_->readback_duration_, video_publisher_->publish_duration_);
+
+  // a frame published around the partial path (probe, shared render, strips,
+  // static layers) leaves display_bounds_ behind, the next one renders fully
+  if (!dirty_region_checked_)
+  {
+    retained_frame_.reset();
+  }
+  dirty_region_checked_ = false;
+
+  if (isSharedMemoryInput())
+  {
+    shm_input_.acknowledge(shm_step_);
+  }
+
+  keyframe_position_ = camera_->getPosition();
+  keyframe_orientation_ = camera_->getOrientation();
+  has_keyframe_ = true;
+}
+
+// One step of a burst per update. While capturing, every update renders a
+// frame and copies it in the texture format into the next preallocated
+// buffer, the scene only changes between updates so this is as fast as
+// distinct frames can be rendered. Afterwards one frame per update is
+// converted and published in order with the stamp of its capture.
+void CameraPub::updateBurst()
+{
+  const QString total = QString::number(burst_frames_.size());
+  if (burst_captured_ < burst_frames_.size())
+  {
+    BurstFrame& frame = burst_frames_[burst_captured_];
+    if (!caminfo_ok_ || !prepareCameraInfo(frame.frame_id))
+      return;
+    frame.camera_info = video_publisher_->camera_info_;
+    // frame_due_ is false, postRenderTargetUpdate() only does the statistics
+    render_texture_->update();
+    video_publisher_->readRegion(rtt_texture_->getBuffer(),
+                                 Ogre::Box(0, 0, render_texture_->getWidth(), render_texture_->getHeight()),
+                                 frame.native, burst_pf_);
+    ++burst_captured_;
+    setStatus(StatusProperty::Ok, "Burst", "Captured " + QString::number(burst_captured_) + " of " + total);
+    return;
+  }
+
+  BurstFrame& frame = burst_frames_[burst_published_];
+  video_publisher_->camera_info_ = frame.camera_info;
+  video_publisher_->publishNative(frame.native, burst_pf_, frame.frame_id, image_encoding_property_->getOptionInt(),
+                                  false);
+  ++burst_published_;
+  if (burst_published_ < burst_frames_.size())
+  {
+    setStatus(StatusProperty::Ok, "Burst", "Published " + QString::number(burst_published_) + " of " + total);
+    return;
+  }
+
+  const double duration = (burst_frames_.back().native->header.stamp -
+                           burst_frames_.front().native->header.stamp).toSec();
+  setStatus(StatusProperty::Ok, "Burst", "Published " + total + " frames captured over " +
+            QString::number(duration, 'f', 2) + " s");
+  burst_frames_.clear();
+  last_image_publication_time_ = ros::Time::now();
+}
+
+// Render one still with the high quality profile into its own target and
+// publish it on the high quality topic: scaled up from the live resolution,
+// supersampled and with the most detailed LOD of every mesh. The camera pose
+// and projection are the ones of the live stream, which is not affected.
+void CameraPub::captureHighQuality()
+{
+  hq_trigger_activated_ = false;
+
+  std::string frame_id;
+  if (!prepareCameraInfo(frame_id))
+    return;
+
+  const int live_width = render_texture_->getWidth();
+  const int live_height = render_texture_->getHeight();
+  const float scale = hq_scale_property_->getFloat();
+  const int supersampling = hq_supersampling_property_->getInt();
+  const int width = std::max(1, static_cast<int>(live_width * scale + 0.5));
+  const int height = std::max(1, static_cast<int>(live_height * scale + 0.5));
+  const int render_width = width * supersampling;
+  const int render_height = height * supersampling;
+  if ((render_width > 8192) || (render_height > 8192))
+  {
+    setStatus(StatusProperty::Error, "High Quality Capture", "Render size " + QString::number(render_width) + "x" +
+              QString::number(render_height) + " is larger than 8192");
+    return;
+  }
+
+  if (hq_texture_.isNull() || (hq_texture_->getWidth() != static_cast<unsigned int>(render_width)) ||
+      (hq_texture_->getHeight() != static_cast<unsigned int>(render_height)))
+  {
+    if (!hq_texture_.isNull())
+    {
+      Ogre::TextureManager::getSingleton().remove(hq_texture_->getName());
+    }
+    hq_texture_ = createRenderTexture(render_width, render_height);
+    hq_texture_->getBuffer()->getRenderTarget()->setActive(true);
+  }
+  Ogre::RenderTexture* hq_render_texture = hq_texture_->getBuffer()->getRenderTarget();
+  hq_render_texture->getViewport(0)->setBackgroundColour(background_color_property_->getOgreColor());
+
+  // set view flags on all displays
+  visibility_property_->update();
+  const Ogre::Real lod_bias = camera_->getLodBias();
+  camera_->setLodBias(hq_lod_bias_property_->getFloat());
+  const bool probe_hidden = latency_probe_->isHidden();
+  latency_probe_->setHidden(true);
+  hq_render_texture->update();
+  latency_probe_->setHidden(probe_hidden);
+  camera_->setLodBias(lod_bias);
+
+  hq_readback_.resize(render_width * render_height * 3);
+  Ogre::PixelBox pb(render_width, render_height, 1, Ogre::PF_BYTE_RGB, &hq_readback_[0]);
+  hq_render_texture->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+
+  // box filter every supersampling x supersampling block down to one pixel
+  sensor_msgs::ImagePtr image(new sensor_msgs::Image);
+  image->header.stamp = ros::Time::now();
+  image->height = height;
+  image->width = width;
+  image->step = width * 3;
+  image->is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+  image->data.resize(image->step * height);
+  const int block = supersampling * supersampling;
+  for (int y = 0; y < height; ++y)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      for (int c = 0; c < 3; ++c)
+      {
+        int sum = 0;
+        for (int sy = 0; sy < supersampling; ++sy)
+        {
+          const uint8_t* row = &hq_readback_[((y * supersampling + sy) * render_width + x * supersampling) * 3];
+          for (int sx = 0; sx < supersampling; ++sx)
+          {
+            sum += row[sx * 3 + c];
+          }
+        }
+        image->data[(y * width + x) * 3 + c] = (sum + block / 2) / block;
+      }
+    }
+  }
+
+  hq_publisher_->camera_info_ = video_publisher_->camera_info_;
+  scaleCameraInfo(hq_publisher_->camera_info_, static_cast<double>(width) / live_width,
+                  static_cast<double>(height) / live_height);
+  if (!hq_publisher_->publishNative(image, Ogre::PF_BYTE_RGB, frame_id, image_encoding_property_->getOptionInt()))
+  {
+    setStatus(StatusProperty::Error, "High Quality Capture", "Could not publish");
+    return;
+  }
+  setStatus(StatusProperty::Ok, "High Quality Capture", "Published " + QString::number(width) + "x" +
+            QString::number(height) + " rendered at " + QString::number(render_width) + "x" +
+            QString::number(render_height));
+}
+
+// Called by the display rendering for this one, only the conversion and
+// publishing happen here
+void CameraPub::publishSharedFrame(const sensor_msgs::ImageConstPtr& native, Ogre::PixelFormat native_pf)
+{
+  trigger_activated_ = false;
+  last_image_publication_time_ = ros::Time::now();
+
+  std::string frame_id;
+  if (!prepareCameraInfo(frame_id))
+    return;
+  if (!video_publisher_->publishNative(native, native_pf, frame_id, image_encoding_property_->getOptionInt()))
+    return;
+  framePublished();
+}
+
+// Displays that would render exactly the same image get the same key,
+// an empty key never shares
+std::string CameraPub::sharedRenderKey()
+{
+  if (!share_render_property_->getBool() || isSharedMemoryInput() || isLidar() ||
+      static_layer_property_->getBool() || accumulate_property_->getBool() ||
+      latency_probe_->isActive() || (strip_rows_property_->getInt() > 0) ||
+      (isOrthographic() && publish_height_property_->getBool()))
+  {
+    return std::string();
+  }
+
+  std::ostringstream ss;
+  if (isOrthographic())
+  {
+    ss << "ortho " << ortho_frame_property_->getFrameStd() << " "
+       << ortho_resolution_property_->getFloat() << " "
+       << ortho_width_property_->getFloat() << " "
+       << ortho_height_property_->getFloat() << " "
+       << ortho_altitude_property_->getFloat();
+  }
+  else
+  {
+    ss << "perspective " << update_nh_.resolveName(camera_info_property_->getTopicStd());
+  }
+  const Ogre::ColourValue color = background_color_property_->getOgreColor();
+  ss << " " << near_clip_property_->getFloat()
+     << " " << color.r << " " << color.g << " " << color.b << " " << color.a;
+
+  // the displays this camera sees, the bits are refreshed here as a
+  // display not rendering itself does not get preRenderTargetUpdate()
+  visibility_property_->update();
+  std::vector<Display*> visible;
+  collectVisibleDisplays(context_->getRootDisplayGroup(), visible);
+  for (size_t i = 0; i < visible.size(); ++i)
+  {
+    ss << " " << visible[i];
+  }
+  return ss.str();
+}
+
+void CameraPub::collectVisibleDisplays(DisplayGroup* group, std::vector<Display*>& displays)
+{
+  for (int i = 0; i < group->numDisplays(); ++i)
+  {
+    Display* display = group->getDisplayAt(i);
+    if (!display->isEnabled())
+      continue;
+    DisplayGroup* child_group = qobject_cast<DisplayGroup*>(display);
+    if (child_group)
+    {
+      collectVisibleDisplays(child_group, displays);
+      continue;
+    }
+    if (display->getVisibilityBits() & vis_bit_)
+    {
+      displays.push_back(display);
+    }
+  }
+}
+
+// The first enabled display with the same key renders for all of them
+CameraPub* CameraPub::sharedRenderLeader()
+{
+  if (shared_render_key_.empty())
+    return this;
+  for (size_t i = 0; i < instances_.size(); ++i)
+  {
+    CameraPub* other = instances_[i];
+    if ((other == this) || (other->isEnabled() && (other->shared_render_key_ == shared_render_key_)))
+    {
+      return other;
+    }
+  }
+  return this;
+}
+
+bool CameraPub::isFrameDue(const ros::Time& cur_time)
+{
+  if (trigger_activated_)
+  {
+    return true;
+  }
+
+  ros::Duration elapsed_duration = cur_time - last_image_publication_time_;
+  float frame_rate = frame_rate_property_->getFloat();
+  const float rate_limit = bandwidth_controller_->rate_limit();
+  if ((rate_limit > 0.0) && (frame_rate != 0.0))
+  {
+    frame_rate = (frame_rate < 0.0) ? rate_limit : std::min(frame_rate, rate_limit);
+  }
+  bool time_is_up = (frame_rate > 0.0) && (elapsed_duration.toSec() > 1.0 / frame_rate);
+  // We want frame rate to be unlimited if we enter zero or negative values for frame rate
+  if (frame_rate < 0.0)
+  {
+    time_is_up = true;
+  }
+  if (!time_is_up)
+  {
+    return false;
+  }
+
+  if (!keyframe_property_->getBool() || !has_keyframe_)
+  {
+    return true;
+  }
+
+  const float max_interval = keyframe_max_interval_property_->getFloat();
+  if ((max_interval > 0.0) && (elapsed_duration.toSec() >= max_interval))
+  {
+    return true;
+  }
+
+  const Ogre::Real distance = camera_->getPosition().distance(keyframe_position_);
+  if (distance >= keyframe_translation_property_->getFloat())
+  {
+    return true;
+  }
+
+  // q and -q are the same rotation
+  const Ogre::Real dot = std::min<Ogre::Real>(1.0, std::abs(keyframe_orientation_.Dot(camera_->getOrientation())));
+  const Ogre::Degree angle = Ogre::Radian(2.0 * std::acos(dot));
+  return angle.valueDegrees() >= keyframe_rotation_property_->getFloat();
+}
+
+void CameraPub::updateRenderStats()
+{
+  const ros::WallTime now = ros::WallTime::now();
+  if ((now - last_stats_report_).toSec() < 1.0)
+  {
+    return;
+  }
+  last_stats_report_ = now;
+  if (render_stats_.frames == 0)
+  {
+    return;
+  }
+
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(2)
+     << render_stats_.frames << " renders, "
+     << render_stats_.triangles << " triangles, "
+     << render_stats_.batches << " batches, "
+     << render_stats_.culled << " displays culled, render "
+     << render_stats_.render_ms << " ms, readback "
+     << render_stats_.readback_ms << " ms, publish "
+     << render_stats_.publish_ms << " ms";
+  setStatus(StatusProperty::Ok, "Render Stats", ss.str().c_str());
+
+  if (diagnostics_property_->getBool())
+  {
+    diagnostic_msgs::DiagnosticArray array;
+    array.header.stamp = ros::Time::now();
+    diagnostic_msgs::DiagnosticStatus status;
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.name = "rviz_camera_stream: " + getName().toStdString();
+    status.hardware_id = video_publisher_->get_topic();
+    status.message = ss.str();
+    addDiagnosticValue(status, "renders", render_stats_.frames);
+    addDiagnosticValue(status, "triangles", render_stats_.triangles);
+    addDiagnosticValue(status, "batches", render_stats_.batches);
+    addDiagnosticValue(status, "culled_displays", render_stats_.culled);
+    addDiagnosticValue(status, "render_ms", render_stats_.render_ms);
+    addDiagnosticValue(status, "readback_ms", render_stats_.readback_ms);
+    addDiagnosticValue(status, "publish_ms", render_stats_.publish_ms);
+    array.status.push_back(status);
+    diagnostics_pub_.publish(array);
+  }
+  render_stats_ = RenderStats();
+}
+
+void CameraPub::updateLatencyStatus()
+{
+  if (!latency_probe_->isActive())
+  {
+    return;
+  }
+  const ros::WallTime now = ros::WallTime::now();
+  if ((now - last_latency_report_).toSec() < 1.0)
+  {
+    return;
+  }
+  last_latency_report_ = now;
+
+  const rviz_camera_stream::LatencyProbe::Stats stats = latency_probe_->stats();
+  size_t cameras = 0;
+  for (size_t i = 0; i < instances_.size(); ++i)
+  {
+    cameras += instances_[i]->isEnabled() ? 1 : 0;
+  }
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(1)
+     << stats.samples << " samples at " << render_texture_->getWidth() << "x" << render_texture_->getHeight()
+     << ", frame rate " << frame_rate_property_->getFloat() << ", " << cameras << " camera displays";
+  if (stats.samples > 0)
+  {
+    ss << ": min " << stats.min_ms << " ms, median " << stats.median_ms << " ms, p95 " << stats.p95_ms
+       << " ms, max " << stats.max_ms << " ms";
+  }
+  ss << ", " << stats.missed << " missed";
+  setStatus(stats.missed > 0 ? StatusProperty::Warn : StatusProperty::Ok, "Latency Probe", ss.str().c_str());
+
+  if (diagnostics_property_->getBool())
+  {
+    diagnostic_msgs::DiagnosticArray array;
+    array.header.stamp = ros::Time::now();
+    diagnostic_msgs::DiagnosticStatus status;
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.name = "rviz_camera_stream latency: " + getName().toStdString();
+    status.hardware_id = video_publisher_->get_topic();
+    status.message = ss.str();
+    addDiagnosticValue(status, "samples", stats.samples);
+    addDiagnosticValue(status, "missed", stats.missed);
+    addDiagnosticValue(status, "width", render_texture_->getWidth());
+    addDiagnosticValue(status, "height", render_texture_->getHeight());
+    addDiagnosticValue(status, "frame_rate", frame_rate_property_->getFloat());
+    addDiagnosticValue(status, "camera_displays", cameras);
+    addDiagnosticValue(status, "min_ms", stats.min_ms);
+    addDiagnosticValue(status, "median_ms", stats.median_ms);
+    addDiagnosticValue(status, "p95_ms", stats.p95_ms);
+    addDiagnosticValue(status, "max_ms", stats.max_ms);
+    addDiagnosticValue(status, "mean_ms", stats.mean_ms);
+    array.status.push_back(status);
+    diagnostics_pub_.publish(array);
+  }
+}
+
+// The sender skips frames that need more datagrams than a fragment index can
+// number, which only a larger fragment size fixes
+void CameraPub::updateMulticastStatus()
+{
+  const uint64_t oversized = multicast_sender_.oversized();
+  if (!multicast_sender_.isOpen() || (oversized == multicast_oversized_))
+  {
+    return;
+  }
+  multicast_oversized_ = oversized;
+  setStatus(StatusProperty::Warn, "Multicast", QString::number(oversized) +
+            " frames not sent, they need more than 65535 datagrams. Raise the Fragment Size.");
+}
+
+void CameraPub::updateBandwidthStatus()
+{
+  const float target_kbps = bandwidth_property_->getFloat();
+  if (!bandwidth_controller_->update(target_kbps * 1000.0, min_quality_property_->getInt(),
+                                     max_quality_property_->getInt()))
+  {
+    return;
+  }
+  if (bandwidth_controller_->is_idle())
+  {
+    setStatus(StatusProperty::Ok, "Bandwidth",
+              QString::fromStdString("No subscribers on " + bandwidth_controller_->topic()));
+    return;
+  }
+
+  std::ostringstream ss;
+  ss << static_cast<int>(bandwidth_controller_->achieved_bps() / 1000.0) << " of "
+     << target_kbps << " kbit/s, jpeg quality " << bandwidth_controller_->quality();
+  if (bandwidth_controller_->rate_limit() > 0.0)
+  {
+    ss << ", limited to " << bandwidth_controller_->rate_limit() << " fps";
+  }
+  setStatus(StatusProperty::Ok, "Bandwidth", ss.str().c_str());
+}
+
+void CameraPub::publishHeight(const std_msgs::Header& header)
+{
+  if (height_pub_.getTopic().empty())
+    return;
+
+  const unsigned int width = render_texture_->getWidth();
+  const unsigned int height = render_texture_->getHeight();
+  if (!depth_render_texture_ ||
+      (depth_render_texture_->getWidth() != width) ||
+      (depth_render_texture_->getHeight() != height))
+  {
+    if (!depth_texture_.isNull())
+    {
+      Ogre::TextureManager::getSingleton().remove(depth_texture_->getName());
+    }
+    std::stringstream ss;
+    static int count = 0;
+    ss << "RvizCameraPubDepthTex" << count++;
+    depth_texture_ = Ogre::TextureManager::getSingleton().createManual(
+        ss.str(),
+        Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+        Ogre::TEX_TYPE_2D,
+        width, height,
+        0,
+        Ogre::PF_R8G8B8,
+        Ogre::TU_RENDERTARGET);
+    depth_render_texture_ = depth_texture_->getBuffer()->getRenderTarget();
+    depth_render_texture_->addViewport(camera_);
+    // the selection manager provides the "Depth" scheme to every material,
+    // it packs the view space depth normalized by the far clip into rgb
+    depth_render_texture_->getViewport(0)->setMaterialScheme("Depth");
+    depth_render_texture_->getViewport(0)->setClearEveryFrame(true);
+    depth_render_texture_->getViewport(0)->setBackgroundColour(Ogre::ColourValue::Black);
+    depth_render_texture_->getViewport(0)->setVisibilityMask(vis_bit_);
+    depth_render_texture_->getViewport(0)->setOverlaysEnabled(false);
+    depth_render_texture_->setAutoUpdated(false);
+  }
+
+  // the visibility bits are still set from the color render
+  depth_render_texture_->update();
+
+  std::vector<uint8_t> packed(width * height * 3);
+  Ogre::PixelBox pb(width, height, 1, Ogre::PF_BYTE_RGB, &packed[0]);
+  depth_render_texture_->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+
+  sensor_msgs::Image image;
+  image.header = header;
+  image.height = height;
+  image.width = width;
+  image.encoding = sensor_msgs::image_encodings::TYPE_32FC1;
+  image.is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+  image.step = width * sizeof(float);
+  image.data.resize(image.step * height);
+
+  const float far_clip = camera_->getFarClipDistance();
+  const float altitude = ortho_altitude_property_->getFloat();
+  float* out = reinterpret_cast<float*>(&image.data[0]);
+  for (size_t i = 0; i < width * height; ++i)
+  {
+    const float depth = rviz_camera_stream::decodeDepth(&packed[i * 3]) * far_clip;
+    out[i] = (depth > 0.0) ? altitude - depth : std::numeric_limits<float>::quiet_NaN();
+  }
+
+  height_pub_.publish(image);
+}
+
+void CameraPub::onEnable()
+{
+  standby_requested_ = false;
+  if (standby_)
+  {
+    standby_ = false;
+    deleteStatus("Standby");
+  }
+  else
+  {
+    subscribe();
+  }
+  render_texture_->setActive(true);
+  updateMainView();
+}
+
+// rviz does not call update() on disabled displays, so leaving out the
+// render texture is all warm standby takes
+void CameraPub::onDisable()
+{
+  updateMainView();
+  render_texture_->setActive(false);
+  // shared memory input is in lockstep, see standbyCallback()
+  if ((warm_standby_property_->getBool() || standby_requested_) && !isSharedMemoryInput())
+  {
+    standby_ = true;
+    setStatus(StatusProperty::Ok, "Standby", "Not rendering, topics kept advertised");
+    return;
+  }
+  unsubscribe();
+  updateGstreamer();
+  clear();
+}
+
+void CameraPub::updateFrameCache()
+{
+  const int size = frame_cache_size_property_->getInt();
+  frame_cache_.setLimits(size, frame_cache_age_property_->getFloat());
+  if (video_publisher_)
+  {
+    video_publisher_->setCache((size > 0) ? &frame_cache_ : NULL, size);
+  }
+}
+
+// The response is a copy of the cached frames, serializing it copies them again
+bool CameraPub::getFrameCallback(rviz_camera_stream::GetFrameRequest& req, rviz_camera_stream::GetFrameResponse& res)
+{
+  rviz_camera_stream::FrameCache::Frame frame;
+  rviz_camera_stream::FrameCache::Frame next;
+  if (req.bracket)
+  {
+    res.success = frame_cache_.bracket(req.stamp, frame, next);
+  }
+  else
+  {
+    res.success = frame_cache_.nearest(req.stamp, frame);
+  }
+  ros::Time oldest;
+  ros::Time newest;
+  if (!frame_cache_.span(oldest, newest))
+  {
+    res.message = (frame_cache_size_property_->getInt() > 0) ? "No frames cached yet" : "Frame Cache Size is 0";
+    return true;
+  }
+  std::ostringstream ss;
+  ss << frame_cache_.size() << " frames cached from " << oldest << " to " << newest;
+  res.message = ss.str();
+  if (!res.success)
+  {
+    return true;
+  }
+  res.image = *frame.image;
+  res.camera_info = *frame.camera_info;
+  if (req.bracket)
+  {
+    res.next_image = *next.image;
+    res.next_camera_info = *next.camera_info;
+  }
+  return true;
+}
+
+void CameraPub::updateWarmStandby()
+{
+  if (standby_ && !warm_standby_property_->getBool() && !standby_requested_)
+  {
+    unsubscribe();
+    clear();
+  }
+}
+
+// Service callbacks run in the rviz main thread, so the display can be
+// enabled and disabled from here
+bool CameraPub::standbyCallback(std_srvs::SetBoolRequest& req, std_srvs::SetBoolResponse& res)
+{
+  // nothing would acknowledge the simulator's steps and it would stall
+  if (req.data && isSharedMemoryInput())
+  {
+    res.success = false;
+    res.message = "Shared memory input is in lockstep with the simulator, no standby";
+    return true;
+  }
+  if (req.data == !isEnabled())
+  {
+    res.success = true;
+    res.message = req.data ? "Already disabled" : "Already enabled";
+    return true;
+  }
+  standby_requested_ = req.data;
+  setEnabled(!req.data);
+  res.success = true;
+  res.message = req.data ? "In warm standby" : "Resumed";
+  return true;
+}
+
+void CameraPub::subscribe()
+{
+  if (!isEnabled())
+    return;
+
+  if (isLidar())
+  {
+    deleteStatus("Camera Info");
+    deleteStatus("Output Topic");
+    const std::string cloud_topic = cloud_topic_property_->getTopicStd();
+    if (cloud_topic.empty())
+    {
+      setStatus(StatusProperty::Error, "Point Cloud Topic", "No topic set");
+      return;
+    }
+    cloud_pub_ = nh_.advertise<sensor_msgs::PointCloud2>(cloud_topic, 1);
+    setStatus(StatusProperty::Ok, "Point Cloud Topic", "Topic set");
+    updateGstreamer();
+    return;
+  }
+  deleteStatus("Point Cloud Topic");
+
+  std::string topic_name = topic_property_->getTopicStd();
+  if (topic_name.empty())
+  {
+    setStatus(StatusProperty::Error, "Output Topic", "No topic set");
+    return;
+  }
+
+  std::string error;
+  if (!ros::names::validate(topic_name, error))
+  {
+    setStatus(StatusProperty::Error, "Output Topic", QString(error.c_str()));
+    return;
+  }
+
+
+  const int strip_rows = strip_rows_property_->getInt();
+  video_publisher_->advertise(topic_name, (strip_rows > 0) ?
+      video_export::VideoPublisher::stripQueueSize(render_texture_->getHeight(), strip_rows) : 1);
+  setStatus(StatusProperty::Ok, "Output Topic", "Topic set");
+
+  updateMulticast();
+
+  updateGstreamer();
+
+  const std::string hq_topic = hq_topic_property_->getTopicStd();
+  if (!hq_topic.empty())
+  {
+    hq_publisher_->advertise(hq_topic);
+  }
+
+  updateDiagnostics();
+  updateBandwidth();
+
+  if (isOrthographic())
+  {
+    deleteStatus("Camera Info");
+    const std::string height_topic = height_topic_property_->getTopicStd();
+    if (publish_height_property_->getBool() && !height_topic.empty())
+    {
+      height_pub_ = nh_.advertise<sensor_msgs::Image>(height_topic, 1);
+    }
+    return;
+  }
+
+  if (isSharedMemoryInput())
+  {
+    deleteStatus("Camera Info");
+    return;
+  }
+
+  std::string caminfo_topic = camera_info_property_->getTopicStd();
+  if (caminfo_topic.empty())
+  {
+    setStatus(StatusProperty::Error, "Camera Info", "No topic set");
+    return;
+  }
+
+  // std::string target_frame = fixed_frame_.toStdString();
+  // Display::enableTFFilter(target_frame);
+
+
+  try
+  {
+    // caminfo_sub_.subscribe(update_nh_, caminfo_topic, 1);
+    caminfo_sub_ = update_nh_.subscribe(caminfo_topic, 1, &CameraPub::caminfoCallback, this);
+    setStatus(StatusProperty::Ok, "Camera Info", "OK");
+  }
+  catch (ros::Exception& e)
+  {
+    setStatus(StatusProperty::Error, "Camera Info", QString("Error subscribing: ") + e.what());
+  }
+}
+
+void CameraPub::unsubscribe()
+{
+  frame_cache_.clear();
+  if (standby_)
+  {
+    standby_ = false;
+    deleteStatus("Standby");
+  }
+  video_publisher_->shutdown();
+  video_publisher_->setMulticast(NULL);
+  multicast_sender_.close();
+  // the GStreamer pipeline is left running, updateGstreamer() stops it
+  // unless the topic is advertised again
+  video_publisher_->setGstreamer(NULL);
+  hq_publisher_->shutdown();
+  bandwidth_controller_->stop();
+  diagnostics_pub_.shutdown();
+  caminfo_sub_.shutdown();
+  height_pub_.shutdown();
+  cloud_pub_.shutdown();
+  shm_input_.close();
+}
+
+void CameraPub::forceRender()
+{
+  force_render_ = true;
+  context_->queueRender();
+}
+
+void CameraPub::updateQueueSize()
+{
+}
+
+void CameraPub::updateFrameRate()
+{
+}
+
+void CameraPub::updateKeyframes()
+{
+  const bool keyframes = keyframe_property_->getBool();
+  keyframe_translation_property_->setHidden(!keyframes);
+  keyframe_rotation_property_->setHidden(!keyframes);
+  keyframe_max_interval_property_->setHidden(!keyframes);
+  has_keyframe_ = false;
+}
+
+// The following only restart their own output, the image topic stays
+// advertised and its subscribers connected
+void CameraPub::updateBandwidth()
+{
+  deleteStatus("Bandwidth");
+  if (!video_publisher_)
+  {
+    return;
+  }
+  bandwidth_controller_->stop();
+  if ((bandwidth_property_->getFloat() > 0.0) && video_publisher_->is_active())
+  {
+    bandwidth_controller_->start(nh_, topic_property_->getTopicStd(), max_quality_property_->getInt());
+  }
+}
+
+void CameraPub::updateDiagnostics()
+{
+  diagnostics_pub_.shutdown();
+  if (video_publisher_ && diagnostics_property_->getBool() && video_publisher_->is_active())
+  {
+    diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+  }
+}
+
+// A running pipeline is kept while the topic is advertised again, restarting
+// it would end a recording
+void CameraPub::updateGstreamer()
+{
+  if (!video_publisher_)
+  {
+    return;
+  }
+  const std::string pipeline = gstreamer_pipeline_property_->getStdString();
+  if (pipeline.empty() || !video_publisher_->is_active())
+  {
+    video_publisher_->setGstreamer(NULL);
+#ifdef RVIZ_CAMERA_STREAM_HAVE_GSTREAMER
+    gstreamer_output_.stop();
+#endif
+    deleteStatus("GStreamer");
+    return;
+  }
+#ifdef RVIZ_CAMERA_STREAM_HAVE_GSTREAMER
+  if (!gstreamer_output_.isRunning() || (gstreamer_output_.description() != pipeline))
+  {
+    video_publisher_->setGstreamer(NULL);
+    std::string error;
+    if (!gstreamer_output_.start(pipeline, error))
+    {
+      setStatus(StatusProperty::Error, "GStreamer", QString::fromStdString(error));
+      return;
+    }
+    setStatus(StatusProperty::Ok, "GStreamer", "Pipeline running");
+  }
+  gstreamer_output_.setMaxQueued(gstreamer_queue_property_->getInt());
+  video_publisher_->setGstreamer(&gstreamer_output_);
+#else
+  setStatus(StatusProperty::Error, "GStreamer", "Built without GStreamer");
+#endif
+}
+
+void CameraPub::updateMulticast()
+{
+  if (!video_publisher_)
+  {
+    return;
+  }
+  video_publisher_->setMulticast(NULL);
+  multicast_sender_.close();
+  multicast_oversized_ = 0;
+
+  const std::string multicast_group = multicast_group_property_->getStdString();
+  if (multicast_group.empty() || !video_publisher_->is_active())
+  {
+    deleteStatus("Multicast");
+    return;
+  }
+  std::string multicast_error;
+  if (!multicast_sender_.open(multicast_group, multicast_port_property_->getInt(),
+                              multicast_ttl_property_->getInt(), multicast_interface_property_->getStdString(),
+                              multicast_error))
+  {
+    setStatus(StatusProperty::Error, "Multicast", QString::fromStdString(multicast_error));
+    return;
+  }
+  multicast_sender_.setFragmentSize(multicast_fragment_size_property_->getInt());
+  multicast_sender_.setFecGroup(multicast_fec_group_property_->getInt());
+  video_publisher_->setMulticast(&multicast_sender_);
+  setStatus(StatusProperty::Ok, "Multicast", QString::fromStdString(multicast_group) + ":" +
+            QString::number(multicast_port_property_->getInt()));
+}
+
+void CameraPub::updateNearClipDistance()
+{
+}
+
+
+void CameraPub::updateBackgroundColor()
+{
+}
+
+// The lockstep acknowledge in framePublished() has to follow the actual publish,
+// a frame handed to the publish thread can still be replaced by the next one
+void CameraPub::updateThreadedPublishing()
+{
+  if (video_publisher_)
+  {
+    video_publisher_->setThreaded(threaded_publishing_property_->getBool() && !isSharedMemoryInput());
+  }
+}
+
+// The quad is seen through vis_bit_, which the lidar faces render with as well
+void CameraPub::updateLatencyProbe()
+{
+  if (!initialized())
+  {
+    return;
+  }
+  const bool active = latency_probe_property_->getBool() && !isLidar();
+  if (active != latency_probe_->isActive())
+  {
+    latency_probe_->setActive(active);
+    video_publisher_->setProbe(active ? latency_probe_ : NULL);
+  }
+  if (!active)
+  {
+    deleteStatus("Latency Probe");
+  }
+}
+
+void CameraPub::updateMainView()
 {
-  unsubscribe();
-  reset();
-  subscribe();
-  context_->queueRender();
+  if (!initialized())
+  {
+    return;
+  }
+  bool camera_only = false;
+  ros::param::param("~camera_only", camera_only, false);
+  setMainViewSuspended(isEnabled() && (suspend_main_view_property_->getBool() || camera_only));
 }
 
-void CameraPub::preRenderTargetUpdate(const Ogre::RenderTargetEvent& evt)
+// The main render window is updated by Ogre::Root::renderOneFrame() with all
+// other auto updated targets, the camera textures are updated by hand in
+// update() so they keep their rates when the window is taken out.
+void CameraPub::setMainViewSuspended(bool suspended)
 {
-  // set view flags on all displays
-  visibility_property_->update();
+  if (suspended == main_view_suspended_)
+  {
+    return;
+  }
+  main_view_suspended_ = suspended;
+  main_view_suspenders_ += suspended ? 1 : -1;
+  Ogre::RenderWindow* window = context_->getViewManager()->getRenderPanel()->getRenderWindow();
+  window->setAutoUpdated(main_view_suspenders_ == 0);
+  if (!suspended)
+  {
+    deleteStatus("Main View");
+  }
 }
 
-void CameraPub::postRenderTargetUpdate(const Ogre::RenderTargetEvent& evt)
+// Redraw the suspended main view now and then so it does not look frozen
+void CameraPub::renderMainView()
 {
-  // Publish the rendered window video stream
-  const ros::Time cur_time = ros::Time::now();
-  ros::Duration elapsed_duration = cur_time - last_image_publication_time_;
-  const float frame_rate = frame_rate_property_->getFloat();
-  bool time_is_up = (frame_rate > 0.0) && (elapsed_duration.toSec() > 1.0 / frame_rate);
-  // We want frame rate to be unlimited if we enter zero or negative values for frame rate
-  if (frame_rate < 0.0)
+  const float rate = main_view_rate_property_->getFloat();
+  if (rate > 0.0)
   {
-    time_is_up = true;
+    const ros::WallTime now = ros::WallTime::now();
+    if ((now - last_main_view_render_).toSec() >= 1.0 / rate)
+    {
+      last_main_view_render_ = now;
+      context_->getViewManager()->getRenderPanel()->getRenderWindow()->update();
+    }
+    setStatus(StatusProperty::Ok, "Main View", "Suspended, redrawn at " + QString::number(rate) + " Hz");
   }
-  if (!(trigger_activated_ || time_is_up))
+  else
   {
-    return;
+    setStatus(StatusProperty::Ok, "Main View", "Suspended");
   }
-  trigger_activated_ = false;
-  last_image_publication_time_ = cur_time;
-  render_texture_->getViewport(0)->setBackgroundColour(background_color_property_->getOgreColor());
+}
 
-  std::string frame_id;
+void CameraPub::updateProjection()
+{
+  const bool ortho = isOrthographic();
+  const bool lidar = isLidar();
+  camera_info_property_->setHidden(ortho || lidar);
+  ortho_frame_property_->setHidden(!ortho);
+  ortho_resolution_property_->setHidden(!ortho);
+  ortho_width_property_->setHidden(!ortho);
+  ortho_height_property_->setHidden(!ortho);
+  ortho_altitude_property_->setHidden(!ortho);
+  publish_height_property_->setHidden(!ortho);
+  height_topic_property_->setHidden(!ortho || !publish_height_property_->getBool());
+  lidar_frame_property_->setHidden(!lidar);
+  lidar_faces_property_->setHidden(!lidar);
+  lidar_resolution_property_->setHidden(!lidar);
+  lidar_rings_property_->setHidden(!lidar);
+  lidar_min_elevation_property_->setHidden(!lidar);
+  lidar_max_elevation_property_->setHidden(!lidar);
+  lidar_samples_property_->setHidden(!lidar);
+  lidar_beam_table_property_->setHidden(!lidar);
+  lidar_min_range_property_->setHidden(!lidar);
+  lidar_max_range_property_->setHidden(!lidar);
+  cloud_topic_property_->setHidden(!lidar);
+  if (!ortho)
   {
-    boost::mutex::scoped_lock lock(caminfo_mutex_);
-    if (!current_caminfo_)
-      return;
-    frame_id = current_caminfo_->header.frame_id;
-    video_publisher_->camera_info_ = *current_caminfo_;
+    deleteStatus("Projection");
   }
+  if (!lidar)
+  {
+    deleteStatus("Lidar");
+  }
+  updateLatencyProbe();
 
-  int encoding_option = image_encoding_property_->getOptionInt();
-
-  // render_texture_->update();
-  video_publisher_->publishFrame(render_texture_, frame_id, encoding_option);
+  if (initialized())
+  {
+    updateTopic();
+  }
 }
 
-void CameraPub::onEnable()
+void CameraPub::updateLidar()
 {
-  subscribe();
-  render_texture_->setActive(true);
+  const std::string path = lidar_beam_table_property_->getStdString();
+  if (path.empty())
+  {
+    lidar_beams_ = rviz_camera_stream::DepthLidar::makeBeams(
+        lidar_rings_property_->getInt(),
+        Ogre::Degree(lidar_min_elevation_property_->getFloat()).valueRadians(),
+        Ogre::Degree(lidar_max_elevation_property_->getFloat()).valueRadians(),
+        lidar_samples_property_->getInt());
+  }
+  else
+  {
+    std::string error;
+    if (!rviz_camera_stream::DepthLidar::loadBeams(path, lidar_beams_, error))
+    {
+      lidar_beams_.clear();
+      setStatus(StatusProperty::Error, "Beam Table", QString::fromStdString(error));
+      return;
+    }
+  }
+  deleteStatus("Beam Table");
 }
 
-void CameraPub::onDisable()
+bool CameraPub::isLidar() const
 {
-  render_texture_->setActive(false);
-  unsubscribe();
-  clear();
+  return projection_property_->getOptionInt() == PROJECTION_LIDAR;
 }
 
-void CameraPub::subscribe()
+void CameraPub::publishLidarScan()
 {
-  if (!isEnabled())
-    return;
+  trigger_activated_ = false;
+  last_image_publication_time_ = ros::Time::now();
 
-  std::string topic_name = topic_property_->getTopicStd();
-  if (topic_name.empty())
-  {
-    setStatus(StatusProperty::Error, "Output Topic", "No topic set");
+  if (cloud_pub_.getTopic().empty() || lidar_beams_.empty())
     return;
-  }
 
-  std::string error;
-  if (!ros::names::validate(topic_name, error))
+  const std::string frame = lidar_frame_property_->getFrameStd();
+  Ogre::Vector3 position;
+  Ogre::Quaternion orientation;
+  if (!context_->getFrameManager()->getTransform(frame, ros::Time(), position, orientation))
   {
-    setStatus(StatusProperty::Error, "Output Topic", QString(error.c_str()));
+    std::string error;
+    context_->getFrameManager()->transformHasProblems(frame, ros::Time(), error);
+    setStatus(StatusProperty::Error, "getTransform", error.c_str());
     return;
   }
+  deleteStatus("getTransform");
 
+  const float min_range = lidar_min_range_property_->getFloat();
+  const float max_range = std::max(min_range + 0.01f, lidar_max_range_property_->getFloat());
+  lidar_->configure(lidar_beams_, lidar_faces_property_->getOptionInt(), lidar_resolution_property_->getInt(),
+                    min_range, max_range);
 
-  std::string caminfo_topic = camera_info_property_->getTopicStd();
-  if (caminfo_topic.empty())
-  {
-    setStatus(StatusProperty::Error, "Camera Info", "No topic set");
-    return;
-  }
-
-  // std::string target_frame = fixed_frame_.toStdString();
-  // Display::enableTFFilter(target_frame);
+  // the face targets have no listener, set the view flags here
+  visibility_property_->update();
 
+  sensor_msgs::PointCloud2 cloud;
+  lidar_->scan(position, orientation, cloud);
+  cloud.header.stamp = ros::Time::now();
+  cloud.header.frame_id = frame;
+  cloud_pub_.publish(cloud);
 
-  try
+  std::ostringstream ss;
+  ss << cloud.width << " of " << lidar_beams_.size() << " beams returned";
+  if (lidar_->uncoveredBeams() > 0)
   {
-    // caminfo_sub_.subscribe(update_nh_, caminfo_topic, 1);
-    caminfo_sub_ = update_nh_.subscribe(caminfo_topic, 1, &CameraPub::caminfoCallback, this);
-    setStatus(StatusProperty::Ok, "Camera Info", "OK");
+    ss << ", " << lidar_->uncoveredBeams() << " beams are outside of the 4 faces";
+    setStatus(StatusProperty::Warn, "Lidar", ss.str().c_str());
   }
-  catch (ros::Exception& e)
+  else
   {
-    setStatus(StatusProperty::Error, "Camera Info", QString("Error subscribing: ") + e.what());
+    setStatus(StatusProperty::Ok, "Lidar", ss.str().c_str());
   }
-
-  video_publisher_->advertise(topic_name);
-  setStatus(StatusProperty::Ok, "Output Topic", "Topic set");
 }
 
-void CameraPub::unsubscribe()
+bool CameraPub::isOrthographic() const
 {
-  video_publisher_->shutdown();
-  caminfo_sub_.shutdown();
+  return projection_property_->getOptionInt() == PROJECTION_ORTHOGRAPHIC;
 }
 
-void CameraPub::forceRender()
+void CameraPub::updateInput()
 {
-  force_render_ = true;
-  context_->queueRender();
-}
+  const bool shm = isSharedMemoryInput();
+  shm_name_property_->setHidden(!shm);
+  if (!shm)
+  {
+    deleteStatus("Shared Memory");
+  }
+  updateThreadedPublishing();
 
-void CameraPub::updateQueueSize()
-{
+  if (initialized())
+  {
+    updateTopic();
+  }
 }
 
-void CameraPub::updateFrameRate()
+bool CameraPub::isSharedMemoryInput() const
 {
+  return input_property_->getOptionInt() == INPUT_SHARED_MEMORY;
 }
 
-void CameraPub::updateNearClipDistance()
+bool CameraPub::pollSharedMemory()
 {
-}
+  if (!shm_input_.isOpen())
+  {
+    std::string error;
+    if (!shm_input_.open(shm_name_property_->getStdString(), error))
+    {
+      setStatus(StatusProperty::Warn, "Shared Memory", QString::fromStdString(error));
+      return false;
+    }
+    setStatus(StatusProperty::Ok, "Shared Memory", "Opened [" + shm_name_property_->getString() + "]");
+  }
 
+  rviz_camera_stream::ShmCameraSample sample;
+  if (!shm_input_.read(sample))
+    return false;
 
-void CameraPub::updateBackgroundColor()
-{
+  sensor_msgs::CameraInfo::Ptr info(new sensor_msgs::CameraInfo);
+  info->header.stamp = ros::Time(sample.stamp_sec, sample.stamp_nsec);
+  info->header.frame_id = sample.frame_id;
+  info->width = sample.width;
+  info->height = sample.height;
+  for (size_t i = 0; i < info->P.size(); ++i)
+  {
+    info->P[i] = sample.P[i];
+  }
+  info->K[0] = info->P[0];
+  info->K[2] = info->P[2];
+  info->K[4] = info->P[5];
+  info->K[5] = info->P[6];
+  info->K[8] = 1.0;
+  info->R[0] = info->R[4] = info->R[8] = 1.0;
+
+  {
+    boost::mutex::scoped_lock lock(caminfo_mutex_);
+    current_caminfo_ = info;
+    new_caminfo_ = true;
+  }
+
+  shm_position_ = Ogre::Vector3(sample.position[0], sample.position[1], sample.position[2]);
+  shm_orientation_ = Ogre::Quaternion(sample.orientation[3], sample.orientation[0],
+                                      sample.orientation[1], sample.orientation[2]);
+  shm_step_ = sample.step;
+  // exactly one frame per simulator step
+  trigger_activated_ = true;
+  return true;
 }
 
 void CameraPub::updateDisplayNamespace()
@@ -484,10 +3180,19 @@ void CameraPub::updateDisplayNamespace()
   }
 
   video_publisher_->setNodehandle(nh_);
+  hq_publisher_->setNodehandle(nh_);
 
   // ROS_INFO("New namespace: '%s'", nh_.getNamespace().c_str());
   trigger_service_.shutdown();
   trigger_service_ = nh_.advertiseService(camera_trigger_name_, &CameraPub::triggerCallback, this);
+  burst_service_.shutdown();
+  burst_service_ = nh_.advertiseService(camera_trigger_name_ + "_burst", &CameraPub::burstCallback, this);
+  hq_trigger_service_.shutdown();
+  hq_trigger_service_ = nh_.advertiseService(camera_trigger_name_ + "_hq", &CameraPub::hqTriggerCallback, this);
+  standby_service_.shutdown();
+  standby_service_ = nh_.advertiseService(camera_trigger_name_ + "_standby", &CameraPub::standbyCallback, this);
+  get_frame_service_.shutdown();
+  get_frame_service_ = nh_.advertiseService(camera_trigger_name_ + "_get_frame", &CameraPub::getFrameCallback, this);
 
   /// Check for service name collision
   if (trigger_service_.getService().empty())
@@ -508,6 +3213,7 @@ void CameraPub::updateImageEncoding()
 void CameraPub::clear()
 {
   force_render_ = true;
+  has_keyframe_ = false;
   context_->queueRender();
 
   new_caminfo_ = false;
@@ -524,6 +3230,19 @@ void CameraPub::clear()
 
 void CameraPub::update(float wall_dt, float ros_dt)
 {
+  releaseRetiredTexture();
+
+  if (main_view_suspended_)
+  {
+    renderMainView();
+  }
+
+  // in lockstep with the simulator nothing is rendered between steps
+  if (isSharedMemoryInput() && !pollSharedMemory())
+  {
+    return;
+  }
+
 #if 0
   try
   {
@@ -541,18 +3260,153 @@ void CameraPub::update(float wall_dt, float ros_dt)
   }
 #endif
 
-  if (caminfo_sub_.getNumPublishers() == 0)
+  if (!isOrthographic() && !isLidar() && !isSharedMemoryInput() && caminfo_sub_.getNumPublishers() == 0)
   {
     setStatus(StatusProperty::Warn, "Camera Info",
               "No publishers on [" +
                QString::fromStdString(caminfo_sub_.getTopic()) +
                "].  Topic may not exist.");
   }
-  render_texture_->update();
+
+  updateBandwidthStatus();
+  updateMulticastStatus();
+  updateRenderStats();
+  updateLatencyStatus();
+
+  // burst frames are rendered without the probe and published too late to time it
+  latency_probe_->setHidden(!burst_frames_.empty());
+
+  if (hq_trigger_activated_ && caminfo_ok_ && !isLidar())
+  {
+    captureHighQuality();
+  }
+
+  // the flip is in the scene from the next render on
+  latency_probe_->update(probe_interval_property_->getFloat(), probe_timeout_property_->getFloat());
+
+  const ros::Time now = ros::Time::now();
+  frame_due_ = isFrameDue(now);
+
+  // a burst replaces the live stream until it is published
+  if (!burst_frames_.empty())
+  {
+    frame_due_ = false;
+    updateBurst();
+    return;
+  }
+
+  if (isLidar())
+  {
+    if (frame_due_)
+    {
+      publishLidarScan();
+    }
+    return;
+  }
+
+  shared_followers_.clear();
+  shared_render_key_ = sharedRenderKey();
+  CameraPub* leader = sharedRenderLeader();
+  if (leader != this)
+  {
+    // the leader renders and hands the frame over when this one is due
+    setStatus(StatusProperty::Ok, "Shared Render", "Rendered by " + leader->getName());
+    return;
+  }
+  for (size_t i = 0; i < instances_.size() && !shared_render_key_.empty(); ++i)
+  {
+    CameraPub* other = instances_[i];
+    if ((other != this) && other->isEnabled() && (other->shared_render_key_ == shared_render_key_) &&
+        other->isFrameDue(now))
+    {
+      shared_followers_.push_back(other);
+    }
+  }
+  if (shared_followers_.empty())
+  {
+    deleteStatus("Shared Render");
+  }
+  else
+  {
+    setStatus(StatusProperty::Ok, "Shared Render",
+              "Rendering for " + QString::number(shared_followers_.size()) + " more displays");
+  }
+
+  if (!frame_due_ && shared_followers_.empty())
+  {
+    return;
+  }
+
+  dirty_region_checked_ = false;
+  if (accumulate_property_->getBool() && frame_due_ && shared_followers_.empty() && !latency_probe_->isActive() &&
+      (strip_rows_property_->getInt() <= 0))
+  {
+    deleteStatus("Static Layer");
+    deleteStatus("Partial Render");
+    renderAccumulated();
+    return;
+  }
+  deleteStatus("Accumulation");
+
+  if (static_layer_property_->getBool() && frame_due_ && shared_followers_.empty() && !latency_probe_->isActive() &&
+      (strip_rows_property_->getInt() <= 0))
+  {
+    deleteStatus("Partial Render");
+    renderLayers();
+    return;
+  }
+  deleteStatus("Static Layer");
+
+  partial_render_ = false;
+  if (partial_render_property_->getBool() && frame_due_ && shared_followers_.empty() && !latency_probe_->isActive() &&
+      (strip_rows_property_->getInt() <= 0))
+  {
+    partial_render_ = findDirtyRegion(dirty_region_);
+    const int width = render_texture_->getWidth();
+    const int height = render_texture_->getHeight();
+    if (!partial_render_)
+    {
+      setStatus(StatusProperty::Ok, "Partial Render", "Full render");
+    }
+    else
+    {
+      setStatus(StatusProperty::Ok, "Partial Render", "Rendered " + QString::number(
+                100 * dirty_region_.getWidth() * dirty_region_.getHeight() / (width * height)) + "% of the frame");
+    }
+    if (partial_render_ && ((dirty_region_.getWidth() == 0) || (dirty_region_.getHeight() == 0)))
+    {
+      // nothing changed, publish the previous frame again
+      publishTarget(sensor_msgs::ImageConstPtr(), Ogre::PF_UNKNOWN);
+      return;
+    }
+  }
+  else
+  {
+    deleteStatus("Partial Render");
+  }
+
+  if (partial_render_)
+  {
+    renderRegion(dirty_region_);
+  }
+  else
+  {
+    render_texture_->update();
+  }
 }
 
 bool CameraPub::updateCamera()
 {
+  if (isOrthographic())
+  {
+    return updateOrthoCamera();
+  }
+  // the lidar faces are posed when scanning
+  if (isLidar())
+  {
+    return true;
+  }
+
   sensor_msgs::CameraInfo::ConstPtr info;
   {
     boost::mutex::scoped_lock lock(caminfo_mutex_);
@@ -572,7 +3426,8 @@ bool CameraPub::updateCamera()
 
   // if we're in 'exact' time mode, only show image if the time is exactly right
   ros::Time rviz_time = context_->getFrameManager()->getTime();
-  if (context_->getFrameManager()->getSyncMode() == FrameManager::SyncExact &&
+  if (!isSharedMemoryInput() &&
+      context_->getFrameManager()->getSyncMode() == FrameManager::SyncExact &&
       rviz_time != info->header.stamp)
   {
     std::ostringstream s;
@@ -582,43 +3437,30 @@ bool CameraPub::updateCamera()
   }
 
   // TODO(lucasw) this will make the img vs. texture size code below unnecessary
-  if ((info->width != render_texture_->getWidth()) ||
-      (info->height != render_texture_->getHeight()))
-  {
-    rtt_texture_ = Ogre::TextureManager::getSingleton().createManual(
-        "RttTex",
-        Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
-        Ogre::TEX_TYPE_2D,
-        info->width, info->height,
-        0,
-        Ogre::PF_R8G8B8,
-        Ogre::TU_RENDERTARGET);
-    render_texture_ = rtt_texture_->getBuffer()->getRenderTarget();
-    render_texture_->addViewport(camera_);
-    render_texture_->getViewport(0)->setClearEveryFrame(true);
-    render_texture_->getViewport(0)->setBackgroundColour(Ogre::ColourValue::Black);
-    render_texture_->getViewport(0)->setVisibilityMask(vis_bit_);
-
-    render_texture_->getViewport(0)->setOverlaysEnabled(false);
-    render_texture_->setAutoUpdated(false);
-    render_texture_->setActive(false);
-    render_texture_->addListener(this);
-  }
+  resizeRenderTexture(info->width, info->height);
 
   Ogre::Vector3 position;
   Ogre::Quaternion orientation;
-  const bool success = context_->getFrameManager()->getTransform(
-      info->header.frame_id, info->header.stamp, position, orientation);
-  if (!success)
+  if (isSharedMemoryInput())
   {
-    std::string error;
-    const bool has_problems = context_->getFrameManager()->transformHasProblems(
-        info->header.frame_id,
-        info->header.stamp, error);
-    if (has_problems)
+    position = shm_position_;
+    orientation = shm_orientation_;
+  }
+  else
+  {
+    const bool success = context_->getFrameManager()->getTransform(
+        info->header.frame_id, info->header.stamp, position, orientation);
+    if (!success)
     {
-      setStatus(StatusProperty::Error, "getTransform", error.c_str());
-      return false;
+      std::string error;
+      const bool has_problems = context_->getFrameManager()->transformHasProblems(
+          info->header.frame_id,
+          info->header.stamp, error);
+      if (has_problems)
+      {
+        setStatus(StatusProperty::Error, "getTransform", error.c_str());
+        return false;
+      }
     }
   }
 
@@ -692,6 +3534,7 @@ bool CameraPub::updateCamera()
 
   const float near_clip_distance = near_clip_property_->getFloat();
 
+  camera_->setProjectionType(Ogre::PT_PERSPECTIVE);
   camera_->setPosition(position);
   camera_->setOrientation(orientation);
   camera_->setNearClipDistance(near_clip_distance);
@@ -732,6 +3575,143 @@ bool CameraPub::updateCamera()
   return true;
 }
 
+bool CameraPub::updateOrthoCamera()
+{
+  const float meters_per_pixel = ortho_resolution_property_->getFloat();
+  const float extent_x = ortho_width_property_->getFloat();
+  const float extent_y = ortho_height_property_->getFloat();
+  const float altitude = ortho_altitude_property_->getFloat();
+
+  const unsigned int width = std::max(1, static_cast<int>(extent_x / meters_per_pixel + 0.5));
+  const unsigned int height = std::max(1, static_cast<int>(extent_y / meters_per_pixel + 0.5));
+
+  const std::string frame = ortho_frame_property_->getFrameStd();
+  Ogre::Vector3 position;
+  Ogre::Quaternion orientation;
+  if (!context_->getFrameManager()->getTransform(frame, ros::Time(), position, orientation))
+  {
+    std::string error;
+    context_->getFrameManager()->transformHasProblems(frame, ros::Time(), error);
+    setStatus(StatusProperty::Error, "getTransform", error.c_str());
+    return false;
+  }
+  deleteStatus("getTransform");
+
+  resizeRenderTexture(width, height);
+
+  // Ogre cameras already look down their own -Z with +Y up, so the frame
+  // orientation is used as is
+  position = position + orientation * Ogre::Vector3(0, 0, altitude);
+
+  const double near_plane = near_clip_property_->getFloat();
+  const double far_plane = 2.0 * altitude;
+
+  camera_->setProjectionType(Ogre::PT_ORTHOGRAPHIC);
+  camera_->setPosition(position);
+  camera_->setOrientation(orientation);
+  camera_->setNearClipDistance(near_plane);
+  // the depth scheme normalizes by the far clip distance
+  camera_->setFarClipDistance(far_plane);
+
+  // use the rounded pixel size so the image extent is exactly width * meters_per_pixel
+  Ogre::Matrix4 proj_matrix = Ogre::Matrix4::ZERO;
+  proj_matrix[0][0] = 2.0 / (width * meters_per_pixel);
+  proj_matrix[1][1] = 2.0 / (height * meters_per_pixel);
+  proj_matrix[2][2] = -2.0 / (far_plane - near_plane);
+  proj_matrix[2][3] = -(far_plane + near_plane) / (far_plane - near_plane);
+  proj_matrix[3][3] = 1.0;
+  camera_->setCustomProjectionMatrix(true, proj_matrix);
+
+  // There is no pinhole model, K and P describe an affine camera instead:
+  // P takes x and y in the frame in meters to pixel coordinates and ignores z,
+  // fy is negative as y goes up in the image. A consumer expecting a pinhole
+  // camera gets wrong rays from it, but no division by zero.
+  const double scale = 1.0 / meters_per_pixel;
+  const double cx = 0.5 * width - 0.5;
+  const double cy = 0.5 * height - 0.5;
+  ortho_caminfo_ = sensor_msgs::CameraInfo();
+  ortho_caminfo_.header.frame_id = frame;
+  ortho_caminfo_.width = width;
+  ortho_caminfo_.height = height;
+  ortho_caminfo_.K[0] = scale;
+  ortho_caminfo_.K[2] = cx;
+  ortho_caminfo_.K[4] = -scale;
+  ortho_caminfo_.K[5] = cy;
+  ortho_caminfo_.K[8] = 1.0;
+  ortho_caminfo_.R[0] = 1.0;
+  ortho_caminfo_.R[4] = 1.0;
+  ortho_caminfo_.R[8] = 1.0;
+  ortho_caminfo_.P[0] = scale;
+  ortho_caminfo_.P[3] = cx;
+  ortho_caminfo_.P[5] = -scale;
+  ortho_caminfo_.P[7] = cy;
+  ortho_caminfo_.P[11] = 1.0;
+
+  setStatus(StatusProperty::Ok, "Projection", "Orthographic " + QString::number(width) + "x" +
+            QString::number(height));
+  return true;
+}
+
+Ogre::TexturePtr CameraPub::createRenderTexture(unsigned int width, unsigned int height)
+{
+  std::stringstream ss;
+  static int count = 0;
+  ss << "RvizCameraPubTex" << count++;
+  Ogre::TexturePtr texture = Ogre::TextureManager::getSingleton().createManual(
+      ss.str(),
+      Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+      Ogre::TEX_TYPE_2D,
+      width, height,
+      0,
+      Ogre::PF_R8G8B8,
+      Ogre::TU_RENDERTARGET);
+  Ogre::RenderTexture* render_texture = texture->getBuffer()->getRenderTarget();
+  render_texture->addViewport(camera_);
+  render_texture->getViewport(0)->setClearEveryFrame(true);
+  render_texture->getViewport(0)->setBackgroundColour(Ogre::ColourValue::Black);
+  render_texture->getViewport(0)->setVisibilityMask(vis_bit_);
+
+  render_texture->getViewport(0)->setOverlaysEnabled(false);
+  render_texture->setAutoUpdated(false);
+  render_texture->setActive(false);
+  return texture;
+}
+
+void CameraPub::resizeRenderTexture(unsigned int width, unsigned int height)
+{
+  if ((width == render_texture_->getWidth()) &&
+      (height == render_texture_->getHeight()))
+  {
+    return;
+  }
+
+  // Build the new target completely before it replaces the old one, this is
+  // only called from update() ahead of the render so no frame sees a half
+  // configured target. Readbacks size their buffers from the target they
+  // read, the old texture is released at the start of the next update once
+  // nothing refers to it anymore.
+  Ogre::TexturePtr texture = createRenderTexture(width, height);
+  Ogre::RenderTexture* render_texture = texture->getBuffer()->getRenderTarget();
+  render_texture->setActive(render_texture_->isActive());
+  render_texture->addListener(this);
+
+  render_texture_->removeListener(this);
+  render_texture_->setActive(false);
+  releaseRetiredTexture();
+  retired_texture_ = rtt_texture_;
+
+  rtt_texture_ = texture;
+  render_texture_ = render_texture;
+}
+
+void CameraPub::releaseRetiredTexture()
+{
+  if (retired_texture_.isNull())
+    return;
+  Ogre::TextureManager::getSingleton().remove(retired_texture_->getName());
+  retired_texture_.setNull();
+}
+
 void CameraPub::caminfoCallback(const sensor_msgs::CameraInfo::ConstPtr& msg)
 {
   boost::mutex::scoped_lock lock(caminfo_mutex_);
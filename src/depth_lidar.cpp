@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <OgreCamera.h>
+#include <OgreHardwarePixelBuffer.h>
+#include <OgreRenderTexture.h>
+#include <OgreSceneManager.h>
+#include <OgreTextureManager.h>
+#include <OgreViewport.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rviz_camera_stream/depth_lidar.h"
+
+namespace rviz_camera_stream
+{
+
+namespace
+{
+
+bool sameBeams(const std::vector<DepthLidar::Beam>& a, const std::vector<DepthLidar::Beam>& b)
+{
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); ++i)
+  {
+    if ((a[i].ring != b[i].ring) || (a[i].elevation != b[i].elevation) || (a[i].azimuth != b[i].azimuth))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+DepthLidar::DepthLidar(Ogre::SceneManager* scene_manager, uint32_t visibility_mask) :
+  scene_manager_(scene_manager),
+  visibility_mask_(visibility_mask),
+  resolution_(0),
+  min_range_(0.0),
+  max_range_(0.0),
+  uncovered_(0)
+{
+}
+
+DepthLidar::~DepthLidar()
+{
+  destroyFaces();
+}
+
+std::vector<DepthLidar::Beam> DepthLidar::makeBeams(int rings, float min_elevation, float max_elevation,
+                                                     int horizontal_samples)
+{
+  std::vector<Beam> beams;
+  beams.reserve(rings * horizontal_samples);
+  for (int ring = 0; ring < rings; ++ring)
+  {
+    const float elevation = (rings > 1) ?
+        min_elevation + (max_elevation - min_elevation) * ring / (rings - 1) : min_elevation;
+    for (int i = 0; i < horizontal_samples; ++i)
+    {
+      Beam beam;
+      beam.ring = ring;
+      beam.elevation = elevation;
+      beam.azimuth = 2.0 * M_PI * i / horizontal_samples;
+      beams.push_back(beam);
+    }
+  }
+  return beams;
+}
+
+bool DepthLidar::loadBeams(const std::string& path, std::vector<Beam>& beams, std::string& error)
+{
+  std::ifstream file(path.c_str());
+  if (!file)
+  {
+    error = "Could not open beam table [" + path + "]";
+    return false;
+  }
+
+  beams.clear();
+  std::string line;
+  int line_number = 0;
+  while (std::getline(file, line))
+  {
+    ++line_number;
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+    std::istringstream ss(line);
+    int ring;
+    float elevation;
+    float azimuth;
+    if (!(ss >> ring >> elevation >> azimuth) || (ring < 0))
+    {
+      std::ostringstream msg;
+      msg << "Beam table [" << path << "] line " << line_number << ": expected ring elevation azimuth";
+      error = msg.str();
+      return false;
+    }
+    Beam beam;
+    beam.ring = ring;
+    beam.elevation = elevation * M_PI / 180.0;
+    beam.azimuth = azimuth * M_PI / 180.0;
+    beams.push_back(beam);
+  }
+  if (beams.empty())
+  {
+    error = "Beam table [" + path + "] is empty";
+    return false;
+  }
+  return true;
+}
+
+Ogre::RenderTexture* DepthLidar::createTarget(Ogre::TexturePtr& texture, Ogre::Camera* camera,
+                                              const std::string& scheme)
+{
+  std::stringstream ss;
+  static int count = 0;
+  ss << "RvizCameraPubLidarTex" << count++;
+  texture = Ogre::TextureManager::getSingleton().createManual(
+      ss.str(),
+      Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+      Ogre::TEX_TYPE_2D,
+      resolution_, resolution_,
+      0,
+      Ogre::PF_R8G8B8,
+      Ogre::TU_RENDERTARGET);
+  Ogre::RenderTexture* target = texture->getBuffer()->getRenderTarget();
+  Ogre::Viewport* viewport = target->addViewport(camera);
+  if (!scheme.empty())
+  {
+    viewport->setMaterialScheme(scheme);
+  }
+  viewport->setClearEveryFrame(true);
+  viewport->setBackgroundColour(Ogre::ColourValue::Black);
+  viewport->setVisibilityMask(visibility_mask_);
+  viewport->setOverlaysEnabled(false);
+  target->setAutoUpdated(false);
+  return target;
+}
+
+void DepthLidar::destroyFaces()
+{
+  for (size_t i = 0; i < faces_.size(); ++i)
+  {
+    Ogre::TextureManager::getSingleton().remove(faces_[i].depth_texture->getName());
+    Ogre::TextureManager::getSingleton().remove(faces_[i].color_texture->getName());
+    scene_manager_->destroyCamera(faces_[i].camera);
+  }
+  faces_.clear();
+}
+
+void DepthLidar::configure(const std::vector<Beam>& beams, int faces, int resolution,
+                           float min_range, float max_range)
+{
+  if ((static_cast<int>(faces_.size()) == faces) && (resolution == resolution_) &&
+      (min_range == min_range_) && (max_range == max_range_) && sameBeams(beams, beams_))
+  {
+    return;
+  }
+
+  destroyFaces();
+  beams_ = beams;
+  resolution_ = resolution;
+  min_range_ = min_range;
+  max_range_ = max_range;
+
+  // view axis and image up of every face in the sensor frame
+  const Ogre::Vector3 axes[6][2] =
+  {
+    { Ogre::Vector3::UNIT_X, Ogre::Vector3::UNIT_Z },
+    { Ogre::Vector3::UNIT_Y, Ogre::Vector3::UNIT_Z },
+    { Ogre::Vector3::NEGATIVE_UNIT_X, Ogre::Vector3::UNIT_Z },
+    { Ogre::Vector3::NEGATIVE_UNIT_Y, Ogre::Vector3::UNIT_Z },
+    { Ogre::Vector3::UNIT_Z, Ogre::Vector3::NEGATIVE_UNIT_X },
+    { Ogre::Vector3::NEGATIVE_UNIT_Z, Ogre::Vector3::UNIT_X },
+  };
+
+  for (int i = 0; i < faces; ++i)
+  {
+    Face face;
+    // Ogre cameras look down their -Z with +Y up
+    const Ogre::Vector3 z_axis = -axes[i][0];
+    const Ogre::Vector3 y_axis = axes[i][1];
+    face.rotation = Ogre::Quaternion(y_axis.crossProduct(z_axis), y_axis, z_axis);
+
+    std::stringstream ss;
+    static int count = 0;
+    ss << "RvizCameraPubLidarCamera" << count++;
+    face.camera = scene_manager_->createCamera(ss.str());
+    face.camera->setFOVy(Ogre::Degree(90));
+    face.camera->setAspectRatio(1.0);
+    face.camera->setNearClipDistance(std::max(0.01f, 0.5f * min_range_));
+    // the depth scheme normalizes by the far clip distance
+    face.camera->setFarClipDistance(max_range_);
+
+    face.depth_target = createTarget(face.depth_texture, face.camera, "Depth");
+    face.color_target = createTarget(face.color_texture, face.camera, "");
+    face.depth.resize(resolution_ * resolution_ * 3);
+    face.color.resize(resolution_ * resolution_ * 3);
+    faces_.push_back(face);
+  }
+
+  samples_.clear();
+  samples_.reserve(beams_.size());
+  uncovered_ = 0;
+  for (size_t i = 0; i < beams_.size(); ++i)
+  {
+    const Beam& beam = beams_[i];
+    const Ogre::Vector3 direction(std::cos(beam.elevation) * std::cos(beam.azimuth),
+                                  std::cos(beam.elevation) * std::sin(beam.azimuth),
+                                  std::sin(beam.elevation));
+
+    // the face whose axis is closest to the beam
+    int best = -1;
+    float best_cos = 0.0;
+    for (size_t f = 0; f < faces_.size(); ++f)
+    {
+      const float c = direction.dotProduct(axes[f][0]);
+      if (c > best_cos)
+      {
+        best_cos = c;
+        best = f;
+      }
+    }
+    if (best < 0)
+    {
+      ++uncovered_;
+      continue;
+    }
+
+    const Ogre::Vector3 p = faces_[best].rotation.Inverse() * direction;
+    const float ndc_x = p.x / -p.z;
+    const float ndc_y = p.y / -p.z;
+    // only 4 faces leave the poles uncovered
+    if ((std::abs(ndc_x) > 1.0) || (std::abs(ndc_y) > 1.0))
+    {
+      ++uncovered_;
+      continue;
+    }
+    const int u = std::min(resolution_ - 1, static_cast<int>((ndc_x + 1.0) * 0.5 * resolution_));
+    const int v = std::min(resolution_ - 1, static_cast<int>((1.0 - ndc_y) * 0.5 * resolution_));
+
+    Sample sample;
+    sample.face = best;
+    sample.ring = beam.ring;
+    sample.pixel = v * resolution_ + u;
+    sample.direction = direction;
+    sample.range_scale = 1.0 / -p.z;
+    samples_.push_back(sample);
+  }
+}
+
+void DepthLidar::scan(const Ogre::Vector3& position, const Ogre::Quaternion& orientation,
+                      sensor_msgs::PointCloud2& cloud)
+{
+  for (size_t i = 0; i < faces_.size(); ++i)
+  {
+    Face& face = faces_[i];
+    face.camera->setPosition(position);
+    face.camera->setOrientation(orientation * face.rotation);
+
+    face.depth_target->update();
+    Ogre::PixelBox depth_box(resolution_, resolution_, 1, Ogre::PF_BYTE_RGB, &face.depth[0]);
+    face.depth_target->copyContentsToMemory(depth_box, Ogre::RenderTarget::FB_AUTO);
+
+    face.color_target->update();
+    Ogre::PixelBox color_box(resolution_, resolution_, 1, Ogre::PF_BYTE_RGB, &face.color[0]);
+    face.color_target->copyContentsToMemory(color_box, Ogre::RenderTarget::FB_AUTO);
+  }
+
+  sensor_msgs::PointCloud2Modifier modifier(cloud);
+  modifier.setPointCloud2Fields(5,
+      "x", 1, sensor_msgs::PointField::FLOAT32,
+      "y", 1, sensor_msgs::PointField::FLOAT32,
+      "z", 1, sensor_msgs::PointField::FLOAT32,
+      "intensity", 1, sensor_msgs::PointField::FLOAT32,
+      "ring", 1, sensor_msgs::PointField::UINT16);
+  modifier.resize(samples_.size());
+
+  sensor_msgs::PointCloud2Iterator<float> iter_x(cloud, "x");
+  sensor_msgs::PointCloud2Iterator<float> iter_y(cloud, "y");
+  sensor_msgs::PointCloud2Iterator<float> iter_z(cloud, "z");
+  sensor_msgs::PointCloud2Iterator<float> iter_intensity(cloud, "intensity");
+  sensor_msgs::PointCloud2Iterator<uint16_t> iter_ring(cloud, "ring");
+
+  size_t count = 0;
+  for (size_t i = 0; i < samples_.size(); ++i)
+  {
+    const Sample& sample = samples_[i];
+    const Face& face = faces_[sample.face];
+    const float depth = decodeDepth(&face.depth[sample.pixel * 3]) * max_range_;
+    if (depth <= 0.0)
+      continue;
+    const float range = depth * sample.range_scale;
+    if ((range < min_range_) || (range >= max_range_))
+      continue;
+
+    const uint8_t* rgb = &face.color[sample.pixel * 3];
+    const Ogre::Vector3 point = sample.direction * range;
+    *iter_x = point.x;
+    *iter_y = point.y;
+    *iter_z = point.z;
+    *iter_intensity = 0.299 * rgb[0] + 0.587 * rgb[1] + 0.114 * rgb[2];
+    *iter_ring = sample.ring;
+    ++iter_x;
+    ++iter_y;
+    ++iter_z;
+    ++iter_intensity;
+    ++iter_ring;
+    ++count;
+  }
+  modifier.resize(count);
+  cloud.is_dense = true;
+}
+
+size_t DepthLidar::uncoveredBeams() const
+{
+  return uncovered_;
+}
+
+}  // namespace rviz_camera_stream
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "rviz_camera_stream/frame_cache.h"
+
+namespace rviz_camera_stream
+{
+
+namespace
+{
+
+bool stampLess(const FrameCache::Frame& frame, const ros::Time& stamp)
+{
+  return frame.image->header.stamp < stamp;
+}
+
+}  // namespace
+
+FrameCache::FrameCache() :
+  max_frames_(0)
+{
+}
+
+void FrameCache::setLimits(size_t max_frames, double max_age)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  max_frames_ = max_frames;
+  max_age_ = ros::Duration(std::max(max_age, 0.0));
+  trim();
+}
+
+void FrameCache::add(const sensor_msgs::ImageConstPtr& image, const sensor_msgs::CameraInfoConstPtr& camera_info)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (max_frames_ == 0)
+  {
+    return;
+  }
+  if (!frames_.empty() && (image->header.stamp < frames_.back().image->header.stamp))
+  {
+    frames_.clear();
+  }
+  Frame frame;
+  frame.image = image;
+  frame.camera_info = camera_info;
+  frames_.push_back(frame);
+  trim();
+}
+
+void FrameCache::clear()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  frames_.clear();
+}
+
+// with mutex_ held
+void FrameCache::trim()
+{
+  while (frames_.size() > max_frames_)
+  {
+    frames_.pop_front();
+  }
+  if (frames_.empty() || max_age_.isZero())
+  {
+    return;
+  }
+  const ros::Time newest = frames_.back().image->header.stamp;
+  while (newest - frames_.front().image->header.stamp > max_age_)
+  {
+    frames_.pop_front();
+  }
+}
+
+bool FrameCache::nearest(const ros::Time& stamp, Frame& frame)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (frames_.empty())
+  {
+    return false;
+  }
+  if (stamp.isZero())
+  {
+    frame = frames_.back();
+    return true;
+  }
+  std::deque<Frame>::const_iterator after = std::lower_bound(frames_.begin(), frames_.end(), stamp, stampLess);
+  if (after == frames_.end())
+  {
+    frame = frames_.back();
+  }
+  else if (after == frames_.begin())
+  {
+    frame = frames_.front();
+  }
+  else
+  {
+    std::deque<Frame>::const_iterator before = after - 1;
+    frame = (stamp - before->image->header.stamp <= after->image->header.stamp - stamp) ? *before : *after;
+  }
+  return true;
+}
+
+bool FrameCache::bracket(const ros::Time& stamp, Frame& before, Frame& after)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (frames_.empty() || (stamp < frames_.front().image->header.stamp) ||
+      (stamp > frames_.back().image->header.stamp))
+  {
+    return false;
+  }
+  std::deque<Frame>::const_iterator it = std::lower_bound(frames_.begin(), frames_.end(), stamp, stampLess);
+  after = *it;
+  before = (it->image->header.stamp == stamp) ? *it : *(it - 1);
+  return true;
+}
+
+size_t FrameCache::size()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return frames_.size();
+}
+
+bool FrameCache::span(ros::Time& oldest, ros::Time& newest)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (frames_.empty())
+  {
+    return false;
+  }
+  oldest = frames_.front().image->header.stamp;
+  newest = frames_.back().image->header.stamp;
+  return true;
+}
+
+}  // namespace rviz_camera_stream
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gst/app/gstappsrc.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <boost/bind.hpp>
+#include <sensor_msgs/image_encodings.h>
+#include <string>
+
+#include "rviz_camera_stream/gstreamer_output.h"
+
+namespace rviz_camera_stream
+{
+
+namespace
+{
+
+GstVideoFormat videoFormat(const std::string& encoding)
+{
+  namespace enc = sensor_msgs::image_encodings;
+  if (encoding == enc::RGB8)
+    return GST_VIDEO_FORMAT_RGB;
+  if (encoding == enc::BGR8)
+    return GST_VIDEO_FORMAT_BGR;
+  if (encoding == enc::RGBA8)
+    return GST_VIDEO_FORMAT_RGBA;
+  if (encoding == enc::BGRA8)
+    return GST_VIDEO_FORMAT_BGRA;
+  if (encoding == enc::MONO8)
+    return GST_VIDEO_FORMAT_GRAY8;
+  if (encoding == enc::MONO16)
+    return (G_BYTE_ORDER == G_BIG_ENDIAN) ? GST_VIDEO_FORMAT_GRAY16_BE : GST_VIDEO_FORMAT_GRAY16_LE;
+  return GST_VIDEO_FORMAT_UNKNOWN;
+}
+
+// Called by GStreamer once the last reference to a wrapped buffer is gone
+void releaseImage(gpointer data)
+{
+  delete static_cast<sensor_msgs::ImageConstPtr*>(data);
+}
+
+// Waits for the end of stream so file sinks can finish their file, then
+// releases the pipeline
+void finish(GstElement* pipeline, GstElement* appsrc)
+{
+  GstBus* bus = gst_element_get_bus(pipeline);
+  GstMessage* message = gst_bus_timed_pop_filtered(bus, GST_SECOND,
+      static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  if (message)
+  {
+    gst_message_unref(message);
+  }
+  gst_object_unref(bus);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(appsrc);
+  gst_object_unref(pipeline);
+}
+
+}  // namespace
+
+GstreamerOutput::GstreamerOutput() :
+  pipeline_(NULL),
+  appsrc_(NULL),
+  max_queued_(2),
+  width_(0),
+  height_(0)
+{
+}
+
+GstreamerOutput::~GstreamerOutput()
+{
+  stop();
+  if (finisher_)
+  {
+    finisher_->join();
+  }
+}
+
+bool GstreamerOutput::start(const std::string& pipeline, std::string& error)
+{
+  stop();
+  if (finisher_)
+  {
+    finisher_->join();
+    finisher_.reset();
+  }
+  if (!gst_is_initialized())
+  {
+    gst_init(NULL, NULL);
+  }
+
+  const std::string description = "appsrc name=rviz_camera_stream_src ! " + pipeline;
+  GError* parse_error = NULL;
+  GstElement* element = gst_parse_launch(description.c_str(), &parse_error);
+  if (parse_error)
+  {
+    error = parse_error->message;
+    g_error_free(parse_error);
+    if (element)
+    {
+      gst_object_unref(element);
+    }
+    return false;
+  }
+  GstElement* appsrc = gst_bin_get_by_name(GST_BIN(element), "rviz_camera_stream_src");
+  if (!appsrc)
+  {
+    error = "The pipeline has no appsrc";
+    gst_object_unref(element);
+    return false;
+  }
+  // frames are stamped in push(), pushing never blocks the caller
+  g_object_set(G_OBJECT(appsrc),
+               "format", GST_FORMAT_TIME,
+               "is-live", TRUE,
+               "do-timestamp", FALSE,
+               "block", FALSE,
+               NULL);
+  if (gst_element_set_state(element, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+  {
+    error = "The pipeline could not be started";
+    gst_object_unref(appsrc);
+    gst_element_set_state(element, GST_STATE_NULL);
+    gst_object_unref(element);
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  pipeline_ = element;
+  appsrc_ = appsrc;
+  description_ = pipeline;
+  encoding_.clear();
+  width_ = 0;
+  height_ = 0;
+  error_.clear();
+  return true;
+}
+
+void GstreamerOutput::stop()
+{
+  GstElement* pipeline;
+  GstElement* appsrc;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!pipeline_)
+      return;
+    pipeline = pipeline_;
+    appsrc = appsrc_;
+    pipeline_ = NULL;
+    appsrc_ = NULL;
+    description_.clear();
+  }
+  gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+  if (finisher_)
+  {
+    finisher_->join();
+  }
+  finisher_.reset(new boost::thread(boost::bind(&finish, pipeline, appsrc)));
+}
+
+bool GstreamerOutput::isRunning()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (!pipeline_)
+    return false;
+  pollBus();
+  return error_.empty();
+}
+
+std::string GstreamerOutput::description()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return description_;
+}
+
+void GstreamerOutput::setMaxQueued(size_t max_queued)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  max_queued_ = max_queued;
+}
+
+bool GstreamerOutput::push(const sensor_msgs::ImageConstPtr& image)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (!pipeline_)
+    return false;
+  pollBus();
+
+  const GstVideoFormat format = videoFormat(image->encoding);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    return false;
+  if ((image->encoding != encoding_) || (image->width != width_) || (image->height != height_))
+  {
+    GstVideoInfo info;
+    gst_video_info_set_format(&info, format, image->width, image->height);
+    // the frame rate follows the display, it is not fixed
+    info.fps_n = 0;
+    info.fps_d = 1;
+    GstCaps* caps = gst_video_info_to_caps(&info);
+    gst_app_src_set_caps(GST_APP_SRC(appsrc_), caps);
+    gst_caps_unref(caps);
+    encoding_ = image->encoding;
+    width_ = image->width;
+    height_ = image->height;
+  }
+
+  const guint64 frame_size = image->data.size();
+  if (gst_app_src_get_current_level_bytes(GST_APP_SRC(appsrc_)) > max_queued_ * frame_size)
+    return false;
+
+  // the buffer keeps the image alive, the copy of the pointer is released with it
+  sensor_msgs::ImageConstPtr* reference = new sensor_msgs::ImageConstPtr(image);
+  GstBuffer* buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+      const_cast<uint8_t*>(&image->data[0]), frame_size, 0, frame_size, reference, releaseImage);
+
+  // rows are image->step apart, which need not be the default GStreamer stride
+  gsize offset[GST_VIDEO_MAX_PLANES] = { 0 };
+  gint stride[GST_VIDEO_MAX_PLANES] = { static_cast<gint>(image->step) };
+  gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE, format, image->width, image->height, 1,
+                                 offset, stride);
+
+  // a live source stamps in running time, ROS stamps would be far ahead of
+  // the sinks' clock or go back after a rosbag loop
+  GstClock* clock = gst_element_get_clock(pipeline_);
+  if (clock)
+  {
+    GST_BUFFER_PTS(buffer) = gst_clock_get_time(clock) - gst_element_get_base_time(pipeline_);
+    gst_object_unref(clock);
+  }
+  GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+#if GST_CHECK_VERSION(1, 14, 0)
+  static GstStaticCaps ros_time = GST_STATIC_CAPS("timestamp/x-ros");
+  GstCaps* ros_caps = gst_static_caps_get(&ros_time);
+  gst_buffer_add_reference_timestamp_meta(buffer, ros_caps, image->header.stamp.toNSec(), GST_CLOCK_TIME_NONE);
+  gst_caps_unref(ros_caps);
+#endif
+
+  // takes the buffer
+  return gst_app_src_push_buffer(GST_APP_SRC(appsrc_), buffer) == GST_FLOW_OK;
+}
+
+// Keep the first error for error(), the bus is not watched by a main loop
+void GstreamerOutput::pollBus()
+{
+  GstBus* bus = gst_element_get_bus(pipeline_);
+  GstMessage* message;
+  // everything else is dropped so the bus does not fill up
+  while ((message = gst_bus_pop(bus)) != NULL)
+  {
+    if ((GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) && error_.empty())
+    {
+      GError* gst_error = NULL;
+      gst_message_parse_error(message, &gst_error, NULL);
+      error_ = gst_error->message;
+      g_error_free(gst_error);
+    }
+    gst_message_unref(message);
+  }
+  gst_object_unref(bus);
+}
+
+std::string GstreamerOutput::error()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (pipeline_)
+  {
+    pollBus();
+  }
+  return error_;
+}
+
+}  // namespace rviz_camera_stream
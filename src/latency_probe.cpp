@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <OgreMaterialManager.h>
+#include <OgrePass.h>
+#include <OgreRectangle2D.h>
+#include <OgreSceneManager.h>
+#include <OgreSceneNode.h>
+#include <OgreTechnique.h>
+#include <OgreTextureUnitState.h>
+#include <sensor_msgs/image_encodings.h>
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <vector>
+
+#include "rviz_camera_stream/latency_probe.h"
+
+namespace rviz_camera_stream
+{
+
+namespace
+{
+
+// The quad covers this fraction of the width and height of the view
+const double PROBE_SIZE = 0.05;
+// Enough for a distribution, old samples are dropped beyond it
+const size_t MAX_SAMPLES = 1000;
+
+}  // namespace
+
+LatencyProbe::Stats::Stats() :
+  samples(0),
+  missed(0),
+  min_ms(0.0),
+  median_ms(0.0),
+  p95_ms(0.0),
+  max_ms(0.0),
+  mean_ms(0.0)
+{
+}
+
+LatencyProbe::LatencyProbe(Ogre::SceneManager* scene_manager, uint32_t visibility_mask) :
+  scene_manager_(scene_manager),
+  active_(false),
+  hidden_(false),
+  white_(false),
+  pending_(false),
+  missed_(0)
+{
+  std::stringstream ss;
+  static int count = 0;
+  ss << "RvizCameraPubLatencyProbe" << count++;
+  material_ = Ogre::MaterialManager::getSingleton().create(
+      ss.str(), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+  Ogre::Pass* pass = material_->getTechnique(0)->getPass(0);
+  pass->setLightingEnabled(false);
+  pass->setDepthCheckEnabled(false);
+  pass->setDepthWriteEnabled(false);
+  pass->setCullingMode(Ogre::CULL_NONE);
+  pass->createTextureUnitState();
+  setColour(Ogre::ColourValue::Black);
+
+  quad_ = new Ogre::Rectangle2D(true);
+  quad_->setCorners(-1.0, 1.0, -1.0 + 2.0 * PROBE_SIZE, 1.0 - 2.0 * PROBE_SIZE);
+  quad_->setMaterial(material_->getName());
+  quad_->setRenderQueueGroup(Ogre::RENDER_QUEUE_OVERLAY);
+  quad_->setBoundingBox(Ogre::AxisAlignedBox::BOX_INFINITE);
+  quad_->setVisibilityFlags(visibility_mask);
+  node_ = scene_manager_->getRootSceneNode()->createChildSceneNode();
+  node_->attachObject(quad_);
+  node_->setVisible(false);
+}
+
+LatencyProbe::~LatencyProbe()
+{
+  node_->detachAllObjects();
+  scene_manager_->destroySceneNode(node_);
+  delete quad_;
+  Ogre::MaterialManager::getSingleton().remove(material_->getName());
+}
+
+// With lighting off the pass colour comes from the texture unit alone
+void LatencyProbe::setColour(const Ogre::ColourValue& colour)
+{
+  material_->getTechnique(0)->getPass(0)->getTextureUnitState(0)->setColourOperationEx(
+      Ogre::LBX_SOURCE1, Ogre::LBS_MANUAL, Ogre::LBS_CURRENT, colour);
+}
+
+void LatencyProbe::setActive(bool active)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  active_ = active;
+  node_->setVisible(active && !hidden_);
+  pending_ = false;
+  samples_.clear();
+  missed_ = 0;
+}
+
+bool LatencyProbe::isActive() const
+{
+  return active_;
+}
+
+// A flip that is still pending would be looked for in images rendered
+// without the quad, it is dropped without counting it as missed
+void LatencyProbe::setHidden(bool hidden)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (hidden == hidden_)
+  {
+    return;
+  }
+  hidden_ = hidden;
+  node_->setVisible(active_ && !hidden_);
+  pending_ = false;
+  settle_time_ = ros::WallTime::now();
+}
+
+bool LatencyProbe::isHidden() const
+{
+  return hidden_;
+}
+
+void LatencyProbe::update(double interval, double timeout)
+{
+  if (!active_)
+  {
+    return;
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  if (hidden_)
+  {
+    return;
+  }
+  const ros::WallTime now = ros::WallTime::now();
+  if (pending_ && ((now - flip_time_).toSec() > timeout))
+  {
+    ++missed_;
+    pending_ = false;
+    settle_time_ = now;
+  }
+  if (pending_ || ((now - settle_time_).toSec() < interval))
+  {
+    return;
+  }
+  white_ = !white_;
+  setColour(white_ ? Ogre::ColourValue::White : Ogre::ColourValue::Black);
+  flip_time_ = now;
+  pending_ = true;
+}
+
+// Only the pixel in the middle of the quad is looked at, the rest of it may be
+// blended with the scene by antialiasing
+void LatencyProbe::check(const sensor_msgs::Image& image, uint32_t y_offset, uint32_t frame_height)
+{
+  const ros::WallTime now = ros::WallTime::now();
+  boost::mutex::scoped_lock lock(mutex_);
+  if (!pending_)
+  {
+    return;
+  }
+  if (frame_height == 0)
+  {
+    frame_height = image.height;
+  }
+  const size_t x = image.width * PROBE_SIZE / 2;
+  const size_t frame_y = frame_height * PROBE_SIZE / 2;
+  if ((frame_y < y_offset) || (frame_y >= y_offset + image.height))
+  {
+    return;
+  }
+  const size_t y = frame_y - y_offset;
+  if ((image.step == 0) || ((y + 1) * image.step > image.data.size()))
+  {
+    return;
+  }
+  namespace enc = sensor_msgs::image_encodings;
+  const uint8_t* row = &image.data[y * image.step];
+  int brightness = 0;
+  if ((image.encoding == enc::RGB8) || (image.encoding == enc::BGR8))
+  {
+    brightness = (row[3 * x] + row[3 * x + 1] + row[3 * x + 2]) / 3;
+  }
+  else if ((image.encoding == enc::RGBA8) || (image.encoding == enc::BGRA8))
+  {
+    brightness = (row[4 * x] + row[4 * x + 1] + row[4 * x + 2]) / 3;
+  }
+  else if (image.encoding == enc::MONO8)
+  {
+    brightness = row[x];
+  }
+  else if (image.encoding == enc::MONO16)
+  {
+    brightness = row[2 * x + (image.is_bigendian ? 0 : 1)];
+  }
+  else
+  {
+    return;
+  }
+  if ((brightness >= 128) != white_)
+  {
+    return;
+  }
+  samples_.push_back((now - flip_time_).toSec() * 1000.0);
+  settle_time_ = now;
+  if (samples_.size() > MAX_SAMPLES)
+  {
+    samples_.pop_front();
+  }
+  pending_ = false;
+}
+
+LatencyProbe::Stats LatencyProbe::stats()
+{
+  std::vector<double> samples;
+  Stats stats;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    samples.assign(samples_.begin(), samples_.end());
+    stats.missed = missed_;
+  }
+  stats.samples = samples.size();
+  if (samples.empty())
+  {
+    return stats;
+  }
+  std::sort(samples.begin(), samples.end());
+  stats.min_ms = samples.front();
+  stats.median_ms = samples[samples.size() / 2];
+  stats.p95_ms = samples[std::min(samples.size() - 1, samples.size() * 95 / 100)];
+  stats.max_ms = samples.back();
+  stats.mean_ms = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+  return stats;
+}
+
+}  // namespace rviz_camera_stream
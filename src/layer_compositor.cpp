@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <OgreCamera.h>
+#include <OgreHardwarePixelBuffer.h>
+#include <OgreHighLevelGpuProgramManager.h>
+#include <OgreMaterialManager.h>
+#include <OgrePass.h>
+#include <OgreRectangle2D.h>
+#include <OgreRenderTexture.h>
+#include <OgreSceneManager.h>
+#include <OgreSceneNode.h>
+#include <OgreTechnique.h>
+#include <OgreTextureManager.h>
+#include <OgreTextureUnitState.h>
+#include <OgreViewport.h>
+
+#include <sstream>
+
+#include "rviz_camera_stream/layer_compositor.h"
+
+namespace rviz_camera_stream
+{
+
+namespace
+{
+
+const char* RESTORE_VERTEX_SOURCE =
+    "#version 120\n"
+    "varying vec2 uv;\n"
+    "void main()\n"
+    "{\n"
+    "  gl_Position = vec4(gl_Vertex.xy, 0.0, 1.0);\n"
+    "  uv = gl_MultiTexCoord0.xy;\n"
+    "}\n";
+
+// The "Depth" scheme packs the view space depth in units of the far clip
+// distance into 24 bits of colour, 0 is no hit. The projection rows for z and
+// w turn it back into the depth the hardware would have written.
+const char* RESTORE_FRAGMENT_SOURCE =
+    "#version 120\n"
+    "uniform sampler2D color_texture;\n"
+    "uniform sampler2D depth_texture;\n"
+    "uniform vec4 projection_zw;\n"
+    "uniform float far_clip_distance;\n"
+    "varying vec2 uv;\n"
+    "void main()\n"
+    "{\n"
+    "  gl_FragColor = texture2D(color_texture, uv);\n"
+    "  vec3 bytes = floor(texture2D(depth_texture, uv).rgb * 255.0 + 0.5);\n"
+    "  float depth = (bytes.r * 65536.0 + bytes.g * 256.0 + bytes.b) / 16777215.0;\n"
+    "  if (depth == 0.0)\n"
+    "  {\n"
+    "    gl_FragDepth = 1.0;\n"
+    "    return;\n"
+    "  }\n"
+    "  float z = -depth * far_clip_distance;\n"
+    "  float ndc = (projection_zw.x * z + projection_zw.y) / (projection_zw.z * z + projection_zw.w);\n"
+    "  gl_FragDepth = clamp(0.5 * ndc + 0.5, 0.0, 1.0);\n"
+    "}\n";
+
+Ogre::HighLevelGpuProgramPtr createProgram(const std::string& name, Ogre::GpuProgramType type, const char* source)
+{
+  Ogre::HighLevelGpuProgramManager& manager = Ogre::HighLevelGpuProgramManager::getSingleton();
+  Ogre::HighLevelGpuProgramPtr program = manager.getByName(name);
+  if (program.isNull())
+  {
+    program = manager.createProgram(name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME, "glsl", type);
+    program->setSource(source);
+    program->load();
+  }
+  return program;
+}
+
+}  // namespace
+
+LayerCompositor::LayerCompositor(Ogre::Camera* camera, uint32_t visibility_mask) :
+  camera_(camera),
+  visibility_mask_(visibility_mask),
+  width_(0),
+  height_(0),
+  has_static_(false),
+  color_target_(NULL),
+  depth_target_(NULL),
+  output_target_(NULL),
+  restore_quad_(NULL),
+  restore_node_(NULL)
+{
+}
+
+LayerCompositor::~LayerCompositor()
+{
+  destroyTargets();
+  if (restore_node_)
+  {
+    restore_node_->detachAllObjects();
+    camera_->getSceneManager()->destroySceneNode(restore_node_);
+    delete restore_quad_;
+    Ogre::MaterialManager::getSingleton().remove(restore_material_->getName());
+  }
+}
+
+void LayerCompositor::destroyTargets()
+{
+  Ogre::TexturePtr* textures[] = { &color_texture_, &depth_texture_, &output_texture_ };
+  for (size_t i = 0; i < sizeof(textures) / sizeof(textures[0]); ++i)
+  {
+    if (!textures[i]->isNull())
+    {
+      Ogre::TextureManager::getSingleton().remove((*textures[i])->getName());
+      textures[i]->setNull();
+    }
+  }
+  color_target_ = NULL;
+  depth_target_ = NULL;
+  output_target_ = NULL;
+  has_static_ = false;
+}
+
+Ogre::RenderTexture* LayerCompositor::createTarget(Ogre::TexturePtr& texture, const std::string& scheme)
+{
+  std::stringstream ss;
+  static int count = 0;
+  ss << "RvizCameraPubLayerTex" << count++;
+  texture = Ogre::TextureManager::getSingleton().createManual(
+      ss.str(),
+      Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+      Ogre::TEX_TYPE_2D,
+      width_, height_,
+      0,
+      Ogre::PF_R8G8B8,
+      Ogre::TU_RENDERTARGET);
+  Ogre::RenderTexture* target = texture->getBuffer()->getRenderTarget();
+  Ogre::Viewport* viewport = target->addViewport(camera_);
+  if (!scheme.empty())
+  {
+    viewport->setMaterialScheme(scheme);
+  }
+  viewport->setClearEveryFrame(true);
+  viewport->setBackgroundColour(Ogre::ColourValue::Black);
+  viewport->setVisibilityMask(visibility_mask_);
+  viewport->setOverlaysEnabled(false);
+  target->setAutoUpdated(false);
+  return target;
+}
+
+// The quad is only shown while the output target renders. It always passes
+// the depth test, which has to be on for its depth to be written.
+void LayerCompositor::createRestoreQuad()
+{
+  std::stringstream ss;
+  static int count = 0;
+  ss << "RvizCameraPubLayerRestore" << count++;
+  restore_material_ = Ogre::MaterialManager::getSingleton().create(
+      ss.str(), Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME);
+  Ogre::Pass* pass = restore_material_->getTechnique(0)->getPass(0);
+  pass->setLightingEnabled(false);
+  pass->setCullingMode(Ogre::CULL_NONE);
+  pass->setDepthCheckEnabled(true);
+  pass->setDepthFunction(Ogre::CMPF_ALWAYS_PASS);
+  pass->setDepthWriteEnabled(true);
+  pass->setVertexProgram(createProgram("RvizCameraPubLayerRestoreVP", Ogre::GPT_VERTEX_PROGRAM,
+                                       RESTORE_VERTEX_SOURCE)->getName());
+  pass->setFragmentProgram(createProgram("RvizCameraPubLayerRestoreFP", Ogre::GPT_FRAGMENT_PROGRAM,
+                                         RESTORE_FRAGMENT_SOURCE)->getName());
+  Ogre::GpuProgramParametersSharedPtr params = pass->getFragmentProgramParameters();
+  params->setNamedConstant("color_texture", 0);
+  params->setNamedConstant("depth_texture", 1);
+  for (int i = 0; i < 2; ++i)
+  {
+    Ogre::TextureUnitState* unit = pass->createTextureUnitState();
+    unit->setTextureFiltering(Ogre::TFO_NONE);
+    unit->setTextureAddressingMode(Ogre::TextureUnitState::TAM_CLAMP);
+  }
+
+  restore_quad_ = new Ogre::Rectangle2D(true);
+  restore_quad_->setCorners(-1.0, 1.0, 1.0, -1.0);
+  restore_quad_->setMaterial(restore_material_->getName());
+  restore_quad_->setRenderQueueGroup(Ogre::RENDER_QUEUE_BACKGROUND);
+  restore_quad_->setBoundingBox(Ogre::AxisAlignedBox::BOX_INFINITE);
+  restore_quad_->setVisibilityFlags(visibility_mask_);
+  restore_node_ = camera_->getSceneManager()->getRootSceneNode()->createChildSceneNode();
+  restore_node_->attachObject(restore_quad_);
+  restore_node_->setVisible(false);
+}
+
+void LayerCompositor::resize(int width, int height)
+{
+  if ((width == width_) && (height == height_) && color_target_)
+  {
+    return;
+  }
+  if (!restore_node_)
+  {
+    createRestoreQuad();
+  }
+  destroyTargets();
+  width_ = width;
+  height_ = height;
+  color_target_ = createTarget(color_texture_, "");
+  depth_target_ = createTarget(depth_texture_, "Depth");
+  output_target_ = createTarget(output_texture_, "");
+  Ogre::Pass* pass = restore_material_->getTechnique(0)->getPass(0);
+  pass->getTextureUnitState(0)->setTextureName(color_texture_->getName());
+  pass->getTextureUnitState(1)->setTextureName(depth_texture_->getName());
+}
+
+bool LayerCompositor::hasStaticLayer() const
+{
+  return has_static_;
+}
+
+void LayerCompositor::renderStatic(const Ogre::ColourValue& background)
+{
+  color_target_->getViewport(0)->setBackgroundColour(background);
+  color_target_->update();
+  depth_target_->update();
+  has_static_ = true;
+}
+
+void LayerCompositor::renderDynamic(sensor_msgs::Image& image)
+{
+  const Ogre::Matrix4 projection = camera_->getProjectionMatrixWithRSDepth();
+  Ogre::GpuProgramParametersSharedPtr params =
+      restore_material_->getTechnique(0)->getPass(0)->getFragmentProgramParameters();
+  params->setNamedConstant("projection_zw", Ogre::Vector4(projection[2][2], projection[2][3],
+                                                          projection[3][2], projection[3][3]));
+  params->setNamedConstant("far_clip_distance", camera_->getFarClipDistance());
+
+  restore_node_->setVisible(true);
+  output_target_->update();
+  restore_node_->setVisible(false);
+
+  image.height = height_;
+  image.width = width_;
+  image.step = width_ * 3;
+  image.is_bigendian = (OGRE_ENDIAN == OGRE_ENDIAN_BIG);
+  image.data.resize(image.step * height_);
+  Ogre::PixelBox pb(width_, height_, 1, Ogre::PF_BYTE_RGB, &image.data[0]);
+  output_target_->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+}
+
+size_t LayerCompositor::triangleCount() const
+{
+  return output_target_->getTriangleCount();
+}
+
+size_t LayerCompositor::batchCount() const
+{
+  return output_target_->getBatchCount();
+}
+
+}  // namespace rviz_camera_stream
@@ -0,0 +1,602 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <ros/serialization.h>
+
+#include "rviz_camera_stream/multicast_image.h"
+
+namespace rviz_camera_stream
+{
+
+namespace
+{
+
+// IPv4 and UDP headers take 28 bytes of an ethernet frame
+const size_t DEFAULT_FRAGMENT_SIZE = 1500 - 28 - sizeof(MulticastFragmentHeader);
+const size_t MAX_DATAGRAM_SIZE = 65507;
+
+bool resolve(const std::string& address, in_addr& out, std::string& error)
+{
+  if (inet_pton(AF_INET, address.c_str(), &out) != 1)
+  {
+    error = "Invalid IPv4 address [" + address + "]";
+    return false;
+  }
+  return true;
+}
+
+std::string socketError(const std::string& what)
+{
+  return what + ": " + strerror(errno);
+}
+
+}  // namespace
+
+const int MulticastImageReceiver::RECEIVE_BUFFER_SIZE;
+const size_t MulticastImageReceiver::DEFAULT_MAX_FRAME_SIZE;
+
+MulticastImageSender::MulticastImageSender() :
+  socket_(-1),
+  fragment_size_(DEFAULT_FRAGMENT_SIZE),
+  fec_group_(0),
+  frame_(0),
+  frame_size_(0),
+  data_count_(0),
+  bytes_sent_(0),
+  oversized_(0)
+{
+  memset(&address_, 0, sizeof(address_));
+}
+
+MulticastImageSender::~MulticastImageSender()
+{
+  close();
+}
+
+bool MulticastImageSender::open(const std::string& group, int port, int ttl, const std::string& interface_address,
+                                std::string& error)
+{
+  close();
+  oversized_ = 0;
+  memset(&address_, 0, sizeof(address_));
+  address_.sin_family = AF_INET;
+  address_.sin_port = htons(port);
+  if (!resolve(group, address_.sin_addr, error))
+    return false;
+  if (!IN_MULTICAST(ntohl(address_.sin_addr.s_addr)))
+  {
+    error = "[" + group + "] is not a multicast address";
+    return false;
+  }
+
+  socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socket_ < 0)
+  {
+    error = socketError("socket");
+    return false;
+  }
+  const unsigned char multicast_ttl = std::max(0, std::min(255, ttl));
+  // receivers on this host, including tests over loopback, get the frames too
+  const unsigned char loop = 1;
+  if ((setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_TTL, &multicast_ttl, sizeof(multicast_ttl)) < 0) ||
+      (setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0))
+  {
+    error = socketError("setsockopt");
+    close();
+    return false;
+  }
+  if (!interface_address.empty())
+  {
+    in_addr interface;
+    if (!resolve(interface_address, interface, error))
+    {
+      close();
+      return false;
+    }
+    if (setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface)) < 0)
+    {
+      error = socketError("IP_MULTICAST_IF");
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void MulticastImageSender::close()
+{
+  if (socket_ >= 0)
+  {
+    ::close(socket_);
+    socket_ = -1;
+  }
+}
+
+bool MulticastImageSender::isOpen() const
+{
+  return socket_ >= 0;
+}
+
+void MulticastImageSender::setFragmentSize(size_t fragment_size)
+{
+  fragment_size_ = std::max<size_t>(1, std::min(fragment_size, MAX_DATAGRAM_SIZE - sizeof(MulticastFragmentHeader)));
+}
+
+void MulticastImageSender::setFecGroup(size_t fec_group)
+{
+  fec_group_ = std::min<size_t>(fec_group, 0xffff);
+}
+
+MulticastFragmentHeader MulticastImageSender::makeHeader(uint16_t index) const
+{
+  MulticastFragmentHeader header;
+  header.magic = htonl(MulticastFragmentHeader::MAGIC);
+  header.frame = htonl(frame_);
+  header.frame_size = htonl(frame_size_);
+  header.index = htons(index);
+  header.data_count = htons(data_count_);
+  header.fragment_size = htons(fragment_size_);
+  header.fec_group = htons(fec_group_);
+  return header;
+}
+
+// One datagram gathered by the kernel from the pieces in iov
+bool MulticastImageSender::sendDatagram(iovec* iov, size_t count)
+{
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_name = &address_;
+  message.msg_namelen = sizeof(address_);
+  message.msg_iov = iov;
+  message.msg_iovlen = count;
+  const ssize_t sent = sendmsg(socket_, &message, 0);
+  if (sent < 0)
+    return false;
+  bytes_sent_ += sent;
+  return true;
+}
+
+// Send size bytes at offset of the serialized frame, which is prefix_
+// followed by the pixel data, straight from where they are
+bool MulticastImageSender::sendFragment(uint16_t index, const uint8_t* data, size_t offset, size_t size)
+{
+  MulticastFragmentHeader header = makeHeader(index);
+  iovec iov[3];
+  size_t count = 0;
+  iov[count].iov_base = &header;
+  iov[count].iov_len = sizeof(header);
+  ++count;
+  if (offset < prefix_.size())
+  {
+    const size_t length = std::min(size, prefix_.size() - offset);
+    iov[count].iov_base = &prefix_[offset];
+    iov[count].iov_len = length;
+    ++count;
+    offset += length;
+    size -= length;
+  }
+  if (size > 0)
+  {
+    iov[count].iov_base = const_cast<uint8_t*>(data + offset - prefix_.size());
+    iov[count].iov_len = size;
+    ++count;
+  }
+  return sendDatagram(iov, count);
+}
+
+// xor size bytes at offset of the serialized frame into parity_
+void MulticastImageSender::addParity(const uint8_t* data, size_t offset, size_t size)
+{
+  size_t j = 0;
+  for (; (j < size) && (offset + j < prefix_.size()); ++j)
+  {
+    parity_[j] ^= prefix_[offset + j];
+  }
+  const uint8_t* pixels = data + offset + j - prefix_.size();
+  for (size_t k = 0; j < size; ++j, ++k)
+  {
+    parity_[j] ^= pixels[k];
+  }
+}
+
+// Only the fields ahead of the pixel data are serialized, into prefix_, the
+// datagrams point into the image for the pixels so they are not copied
+// before the kernel copies them.
+bool MulticastImageSender::send(const sensor_msgs::Image& image)
+{
+  if (!isOpen())
+    return false;
+
+  // serialized like the whole message, up to and including the length of the pixel data
+  const uint32_t data_size = image.data.size();
+  const uint32_t size = ros::serialization::serializationLength(image);
+  prefix_.resize(size - data_size);
+  ros::serialization::OStream stream(&prefix_[0], prefix_.size());
+  ros::serialization::serialize(stream, image.header);
+  ros::serialization::serialize(stream, image.height);
+  ros::serialization::serialize(stream, image.width);
+  ros::serialization::serialize(stream, image.encoding);
+  ros::serialization::serialize(stream, image.is_bigendian);
+  ros::serialization::serialize(stream, image.step);
+  ros::serialization::serialize(stream, data_size);
+  const uint8_t* data = image.data.empty() ? NULL : &image.data[0];
+
+  const size_t data_count = (size + fragment_size_ - 1) / fragment_size_;
+  const size_t parity_count = (fec_group_ > 0) ? (data_count + fec_group_ - 1) / fec_group_ : 0;
+  if (data_count + parity_count > 0xffff)
+  {
+    ++oversized_;
+    return false;
+  }
+
+  ++frame_;
+  frame_size_ = size;
+  data_count_ = data_count;
+  bool ok = true;
+  for (size_t group = 0; group * std::max<size_t>(fec_group_, 1) < data_count; ++group)
+  {
+    const size_t first = (fec_group_ > 0) ? group * fec_group_ : group;
+    const size_t last = (fec_group_ > 0) ? std::min(first + fec_group_, data_count) : first + 1;
+    parity_.assign(fragment_size_, 0);
+    for (size_t i = first; i < last; ++i)
+    {
+      const size_t offset = i * fragment_size_;
+      const size_t length = std::min<size_t>(fragment_size_, size - offset);
+      ok = sendFragment(i, data, offset, length) && ok;
+      if (fec_group_ > 0)
+      {
+        addParity(data, offset, length);
+      }
+    }
+    if (fec_group_ > 0)
+    {
+      MulticastFragmentHeader header = makeHeader(data_count + group);
+      iovec iov[2];
+      iov[0].iov_base = &header;
+      iov[0].iov_len = sizeof(header);
+      iov[1].iov_base = &parity_[0];
+      iov[1].iov_len = parity_.size();
+      ok = sendDatagram(iov, 2) && ok;
+    }
+  }
+  return ok;
+}
+
+uint64_t MulticastImageSender::bytesSent() const
+{
+  return bytes_sent_;
+}
+
+uint64_t MulticastImageSender::oversized() const
+{
+  return oversized_;
+}
+
+MulticastImageReceiver::MulticastImageReceiver(size_t max_pending, size_t max_frame_size) :
+  socket_(-1),
+  max_pending_(std::max<size_t>(1, max_pending)),
+  max_frame_size_(max_frame_size),
+  last_frame_(0),
+  has_last_frame_(false),
+  dropped_(0),
+  recovered_(0)
+{
+}
+
+MulticastImageReceiver::~MulticastImageReceiver()
+{
+  close();
+}
+
+bool MulticastImageReceiver::open(const std::string& group, int port, const std::string& interface_address,
+                                  std::string& error)
+{
+  close();
+  ip_mreq request;
+  memset(&request, 0, sizeof(request));
+  if (!resolve(group, request.imr_multiaddr, error))
+    return false;
+  request.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (!interface_address.empty() && !resolve(interface_address, request.imr_interface, error))
+    return false;
+
+  socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socket_ < 0)
+  {
+    error = socketError("socket");
+    return false;
+  }
+  // several receivers on one host share the port
+  const int reuse = 1;
+  const int buffer_size = RECEIVE_BUFFER_SIZE;
+  if ((setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) ||
+      (setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size)) < 0))
+  {
+    error = socketError("setsockopt");
+    close();
+    return false;
+  }
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr = request.imr_multiaddr;
+  if (bind(socket_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0)
+  {
+    error = socketError("bind");
+    close();
+    return false;
+  }
+  if (setsockopt(socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) < 0)
+  {
+    error = socketError("IP_ADD_MEMBERSHIP");
+    close();
+    return false;
+  }
+  datagram_.resize(MAX_DATAGRAM_SIZE);
+  return true;
+}
+
+void MulticastImageReceiver::close()
+{
+  if (socket_ >= 0)
+  {
+    ::close(socket_);
+    socket_ = -1;
+  }
+  pending_.clear();
+  has_last_frame_ = false;
+}
+
+bool MulticastImageReceiver::isOpen() const
+{
+  return socket_ >= 0;
+}
+
+// Linux reports twice the size set, for its own bookkeeping, so a buffer
+// that was not clamped shows up as at least the size asked for
+int MulticastImageReceiver::receiveBufferSize() const
+{
+  int size = 0;
+  socklen_t length = sizeof(size);
+  if (!isOpen() || (getsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &size, &length) < 0))
+    return 0;
+  return size;
+}
+
+bool MulticastImageReceiver::receive(sensor_msgs::Image& image, int timeout_ms)
+{
+  if (!isOpen())
+    return false;
+
+  pollfd fd;
+  fd.fd = socket_;
+  fd.events = POLLIN;
+  while (poll(&fd, 1, timeout_ms) > 0)
+  {
+    const ssize_t size = recv(socket_, &datagram_[0], datagram_.size(), 0);
+    if (size < 0)
+      return false;
+    if (addDatagram(&datagram_[0], size, image))
+      return true;
+    // only the first datagram is waited for
+    timeout_ms = 0;
+  }
+  return false;
+}
+
+size_t MulticastImageReceiver::fragmentLength(const PendingFrame& pending, size_t index) const
+{
+  const size_t offset = index * pending.fragment_size;
+  return std::min<size_t>(pending.fragment_size, pending.frame_size - offset);
+}
+
+bool MulticastImageReceiver::addDatagram(const uint8_t* datagram, size_t size, sensor_msgs::Image& image)
+{
+  MulticastFragmentHeader header;
+  if (size < sizeof(header))
+    return false;
+  memcpy(&header, datagram, sizeof(header));
+  if (ntohl(header.magic) != MulticastFragmentHeader::MAGIC)
+    return false;
+  const uint32_t frame = ntohl(header.frame);
+  const uint32_t frame_size = ntohl(header.frame_size);
+  const uint16_t index = ntohs(header.index);
+  const uint16_t data_count = ntohs(header.data_count);
+  const uint16_t fragment_size = ntohs(header.fragment_size);
+  const uint16_t fec_group = ntohs(header.fec_group);
+  const uint8_t* payload = datagram + sizeof(header);
+  const size_t payload_size = size - sizeof(header);
+  if ((frame_size == 0) || (frame_size > max_frame_size_) || (fragment_size == 0) ||
+      (data_count != (frame_size + fragment_size - 1) / fragment_size))
+    return false;
+
+  // late fragments are at most a few frames behind the newest one, a frame
+  // further back than any that could still be pending comes from a sender
+  // that restarted its count
+  bool has_newest = has_last_frame_;
+  uint32_t newest = last_frame_;
+  if (!pending_.empty() && (!has_newest || (static_cast<int32_t>(pending_.rbegin()->first - newest) > 0)))
+  {
+    newest = pending_.rbegin()->first;
+    has_newest = true;
+  }
+  if (has_newest && (static_cast<int32_t>(newest - frame) > static_cast<int32_t>(max_pending_)))
+  {
+    pending_.clear();
+    has_last_frame_ = false;
+  }
+  if (has_last_frame_ && (static_cast<int32_t>(frame - last_frame_) <= 0))
+    return false;
+
+  std::map<uint32_t, PendingFrame>::iterator it = pending_.find(frame);
+  if ((it != pending_.end()) &&
+      ((it->second.frame_size != frame_size) || (it->second.data_count != data_count) ||
+       (it->second.fragment_size != fragment_size) || (it->second.fec_group != fec_group)))
+  {
+    // another sender on the same group and port, or a forged datagram
+    return false;
+  }
+  if (it == pending_.end())
+  {
+    PendingFrame pending;
+    pending.frame_size = frame_size;
+    pending.data_count = data_count;
+    pending.fragment_size = fragment_size;
+    pending.fec_group = fec_group;
+    pending.data.resize(frame_size);
+    pending.have.assign(data_count, false);
+    if (fec_group > 0)
+    {
+      pending.parity.resize((data_count + fec_group - 1) / fec_group);
+    }
+    pending.received = 0;
+    it = pending_.insert(std::make_pair(frame, pending)).first;
+    while (pending_.size() > max_pending_)
+    {
+      pending_.erase(pending_.begin());
+      ++dropped_;
+    }
+    it = pending_.find(frame);
+    if (it == pending_.end())
+      return false;
+  }
+  PendingFrame& pending = it->second;
+
+  size_t group;
+  if (index < data_count)
+  {
+    if (pending.have[index] || (payload_size != fragmentLength(pending, index)))
+      return false;
+    memcpy(&pending.data[index * fragment_size], payload, payload_size);
+    pending.have[index] = true;
+    ++pending.received;
+    if (fec_group == 0)
+    {
+      group = 0;
+    }
+    else
+    {
+      group = index / fec_group;
+    }
+  }
+  else
+  {
+    group = index - data_count;
+    if ((group >= pending.parity.size()) || (payload_size != fragment_size))
+      return false;
+    pending.parity[group].assign(payload, payload + payload_size);
+  }
+  if (fec_group > 0)
+  {
+    recover(pending, group);
+  }
+
+  if (pending.received < pending.data_count)
+    return false;
+
+  ros::serialization::IStream stream(&pending.data[0], pending.data.size());
+  try
+  {
+    ros::serialization::deserialize(stream, image);
+  }
+  catch (ros::Exception& e)
+  {
+    pending_.erase(it);
+    ++dropped_;
+    return false;
+  }
+  // frames older than this one can not complete anymore
+  dropped_ += std::distance(pending_.begin(), it);
+  pending_.erase(pending_.begin(), ++it);
+  last_frame_ = frame;
+  has_last_frame_ = true;
+  return true;
+}
+
+// Rebuild the one missing data fragment of a group from its parity
+void MulticastImageReceiver::recover(PendingFrame& pending, size_t group)
+{
+  if (pending.parity[group].empty())
+    return;
+  const size_t first = group * pending.fec_group;
+  const size_t last = std::min<size_t>(first + pending.fec_group, pending.data_count);
+  size_t missing = last;
+  for (size_t i = first; i < last; ++i)
+  {
+    if (pending.have[i])
+      continue;
+    if (missing != last)
+      return;
+    missing = i;
+  }
+  if (missing == last)
+    return;
+
+  std::vector<uint8_t> fragment = pending.parity[group];
+  for (size_t i = first; i < last; ++i)
+  {
+    if (i == missing)
+      continue;
+    const uint8_t* data = &pending.data[i * pending.fragment_size];
+    const size_t length = fragmentLength(pending, i);
+    for (size_t j = 0; j < length; ++j)
+    {
+      fragment[j] ^= data[j];
+    }
+  }
+  memcpy(&pending.data[missing * pending.fragment_size], &fragment[0], fragmentLength(pending, missing));
+  pending.have[missing] = true;
+  ++pending.received;
+  ++recovered_;
+}
+
+uint64_t MulticastImageReceiver::dropped() const
+{
+  return dropped_;
+}
+
+uint64_t MulticastImageReceiver::recovered() const
+{
+  return recovered_;
+}
+
+}  // namespace rviz_camera_stream
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ros/ros.h>
+#include <sensor_msgs/Image.h>
+#include <string>
+
+#include "rviz_camera_stream/multicast_image.h"
+
+// Joins the multicast group of a CameraPub display and republishes the
+// frames on the local image topic.
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "multicast_image_receiver");
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  std::string group;
+  int port;
+  std::string interface_address;
+  private_nh.param<std::string>("group", group, "239.255.0.1");
+  private_nh.param("port", port, 5004);
+  private_nh.param<std::string>("interface", interface_address, "");
+
+  rviz_camera_stream::MulticastImageReceiver receiver;
+  std::string error;
+  if (!receiver.open(group, port, interface_address, error))
+  {
+    ROS_FATAL_STREAM("Could not join " << group << ":" << port << ": " << error);
+    return 1;
+  }
+  if (receiver.receiveBufferSize() < rviz_camera_stream::MulticastImageReceiver::RECEIVE_BUFFER_SIZE)
+  {
+    ROS_WARN_STREAM("Receive buffer is " << receiver.receiveBufferSize() << " bytes instead of "
+                    << rviz_camera_stream::MulticastImageReceiver::RECEIVE_BUFFER_SIZE
+                    << ", frames may be lost in bursts. Raise net.core.rmem_max to fix it.");
+  }
+
+  ros::Publisher pub = nh.advertise<sensor_msgs::Image>("image", 1);
+  uint64_t dropped = 0;
+  while (ros::ok())
+  {
+    sensor_msgs::ImagePtr image(new sensor_msgs::Image);
+    if (receiver.receive(*image, 100))
+    {
+      pub.publish(image);
+    }
+    if (receiver.dropped() != dropped)
+    {
+      dropped = receiver.dropped();
+      ROS_WARN_STREAM_THROTTLE(5.0, dropped << " incomplete frames dropped, " << receiver.recovered()
+                               << " fragments recovered from parity");
+    }
+    ros::spinOnce();
+  }
+  return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "rviz_camera_stream/shm_camera_input.h"
+
+namespace bip = boost::interprocess;
+
+namespace rviz_camera_stream
+{
+
+namespace
+{
+
+void copyState(const ShmCameraState* state, ShmCameraSample& sample)
+{
+  sample.step = state->step;
+  sample.stamp_sec = state->stamp_sec;
+  sample.stamp_nsec = state->stamp_nsec;
+  sample.frame_id.assign(state->frame_id, strnlen(state->frame_id, sizeof(state->frame_id)));
+  memcpy(sample.position, state->position, sizeof(sample.position));
+  memcpy(sample.orientation, state->orientation, sizeof(sample.orientation));
+  sample.width = state->width;
+  sample.height = state->height;
+  memcpy(sample.P, state->P, sizeof(sample.P));
+}
+
+}  // namespace
+
+ShmCameraInput::ShmCameraInput() :
+  state_(NULL),
+  last_step_(0),
+  has_step_(false)
+{
+}
+
+bool ShmCameraInput::open(const std::string& name, std::string& error)
+{
+  close();
+  try
+  {
+    shm_.reset(new bip::shared_memory_object(bip::open_only, name.c_str(), bip::read_write));
+    region_.reset(new bip::mapped_region(*shm_, bip::read_write));
+  }
+  catch (bip::interprocess_exception& e)
+  {
+    error = e.what();
+    close();
+    return false;
+  }
+
+  if (region_->get_size() < sizeof(ShmCameraState))
+  {
+    error = "Shared memory region is too small";
+    close();
+    return false;
+  }
+
+  ShmCameraState* state = static_cast<ShmCameraState*>(region_->get_address());
+  if ((state->magic != ShmCameraState::MAGIC) || (state->version != ShmCameraState::VERSION))
+  {
+    error = "Shared memory region has an unknown layout";
+    close();
+    return false;
+  }
+
+  state_ = state;
+  name_ = name;
+  return true;
+}
+
+void ShmCameraInput::close()
+{
+  state_ = NULL;
+  region_.reset();
+  shm_.reset();
+  name_.clear();
+  has_step_ = false;
+}
+
+bool ShmCameraInput::isOpen() const
+{
+  return state_ != NULL;
+}
+
+const std::string& ShmCameraInput::name() const
+{
+  return name_;
+}
+
+bool ShmCameraInput::read(ShmCameraSample& sample)
+{
+  if (!state_)
+    return false;
+
+  const uint64_t begin = state_->sequence.load(std::memory_order_acquire);
+  // the writer is in the middle of an update, try again next update
+  if (begin & 1)
+    return false;
+  if (has_step_ && (state_->step == last_step_))
+    return false;
+
+  copyState(state_, sample);
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (state_->sequence.load(std::memory_order_relaxed) != begin)
+    return false;
+
+  last_step_ = sample.step;
+  has_step_ = true;
+  return true;
+}
+
+void ShmCameraInput::acknowledge(uint64_t step)
+{
+  if (!state_)
+    return;
+  state_->rendered_step.store(step, std::memory_order_release);
+}
+
+ShmCameraWriter::ShmCameraWriter() :
+  state_(NULL)
+{
+}
+
+ShmCameraWriter::~ShmCameraWriter()
+{
+  region_.reset();
+  shm_.reset();
+  if (!name_.empty())
+  {
+    bip::shared_memory_object::remove(name_.c_str());
+  }
+}
+
+bool ShmCameraWriter::create(const std::string& name, std::string& error)
+{
+  try
+  {
+    shm_.reset(new bip::shared_memory_object(bip::open_or_create, name.c_str(), bip::read_write));
+    shm_->truncate(sizeof(ShmCameraState));
+    region_.reset(new bip::mapped_region(*shm_, bip::read_write));
+  }
+  catch (bip::interprocess_exception& e)
+  {
+    error = e.what();
+    region_.reset();
+    shm_.reset();
+    return false;
+  }
+
+  name_ = name;
+  state_ = new (region_->get_address()) ShmCameraState();
+  state_->magic = ShmCameraState::MAGIC;
+  state_->version = ShmCameraState::VERSION;
+  state_->sequence.store(0);
+  state_->rendered_step.store(0);
+  state_->step = 0;
+  return true;
+}
+
+void ShmCameraWriter::write(const ShmCameraSample& sample)
+{
+  if (!state_)
+    return;
+
+  const uint64_t seq = state_->sequence.load(std::memory_order_relaxed);
+  state_->sequence.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  state_->step = sample.step;
+  state_->stamp_sec = sample.stamp_sec;
+  state_->stamp_nsec = sample.stamp_nsec;
+  memset(state_->frame_id, 0, sizeof(state_->frame_id));
+  strncpy(state_->frame_id, sample.frame_id.c_str(), sizeof(state_->frame_id) - 1);
+  memcpy(state_->position, sample.position, sizeof(state_->position));
+  memcpy(state_->orientation, sample.orientation, sizeof(state_->orientation));
+  state_->width = sample.width;
+  state_->height = sample.height;
+  memcpy(state_->P, sample.P, sizeof(state_->P));
+
+  state_->sequence.store(seq + 2, std::memory_order_release);
+}
+
+uint64_t ShmCameraWriter::renderedStep() const
+{
+  if (!state_)
+    return 0;
+  return state_->rendered_step.load(std::memory_order_acquire);
+}
+
+}  // namespace rviz_camera_stream
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <ros/console.h>
+
+#include "rviz_camera_stream/strip_assembler.h"
+
+namespace rviz_camera_stream
+{
+
+StripAssembler::StripAssembler(size_t max_pending) :
+  max_pending_(max_pending > 0 ? max_pending : 1),
+  dropped_(0)
+{
+}
+
+sensor_msgs::ImagePtr StripAssembler::add(const sensor_msgs::ImageConstPtr& strip,
+                                          const sensor_msgs::CameraInfoConstPtr& info)
+{
+  const uint32_t y0 = info->roi.y_offset;
+  if ((strip->height == 0) || (y0 >= info->height) || (strip->height > info->height - y0) ||
+      (strip->width != info->width))
+  {
+    ROS_WARN_THROTTLE(1.0, "Strip at row %u with %ux%u does not fit a %ux%u frame",
+                      y0, strip->width, strip->height, info->width, info->height);
+    return sensor_msgs::ImagePtr();
+  }
+  if ((strip->step < strip->width) || (strip->data.size() < static_cast<size_t>(strip->height) * strip->step))
+  {
+    ROS_WARN_THROTTLE(1.0, "Strip at row %u with step %u has %zu bytes for %u rows", y0, strip->step,
+                      strip->data.size(), strip->height);
+    return sensor_msgs::ImagePtr();
+  }
+
+  std::deque<PendingFrame>::iterator it = pending_.begin();
+  for (; it != pending_.end(); ++it)
+  {
+    if (it->image->header.stamp == strip->header.stamp)
+      break;
+  }
+
+  if (it == pending_.end())
+  {
+    // a strip of a frame that was already completed or dropped, unless time
+    // went back, as the strips of a frame are published right after another
+    if (done_stamp_ - strip->header.stamp > ros::Duration(1.0))
+    {
+      done_stamp_ = ros::Time();
+      pending_.clear();
+    }
+    if (strip->header.stamp <= done_stamp_)
+      return sensor_msgs::ImagePtr();
+
+    PendingFrame frame;
+    frame.image.reset(new sensor_msgs::Image);
+    frame.image->header = strip->header;
+    frame.image->encoding = strip->encoding;
+    frame.image->is_bigendian = strip->is_bigendian;
+    frame.image->width = info->width;
+    frame.image->height = info->height;
+    frame.image->step = strip->step;
+    frame.image->data.resize(static_cast<size_t>(strip->step) * info->height);
+    frame.have_row.assign(info->height, false);
+    frame.rows_received = 0;
+    pending_.push_back(frame);
+    while (pending_.size() > max_pending_)
+    {
+      done_stamp_ = std::max(done_stamp_, pending_.front().image->header.stamp);
+      pending_.pop_front();
+      ++dropped_;
+    }
+    it = pending_.end() - 1;
+  }
+
+  sensor_msgs::Image& image = *it->image;
+  if ((strip->step != image.step) || (strip->encoding != image.encoding) || (info->width != image.width) ||
+      (info->height != image.height))
+  {
+    ROS_WARN_THROTTLE(1.0, "Strip encoding, step or frame size changed within a frame");
+    return sensor_msgs::ImagePtr();
+  }
+
+  memcpy(&image.data[static_cast<size_t>(y0) * image.step], &strip->data[0],
+         static_cast<size_t>(strip->height) * strip->step);
+  for (uint32_t y = y0; y < y0 + strip->height; ++y)
+  {
+    if (!it->have_row[y])
+    {
+      it->have_row[y] = true;
+      ++it->rows_received;
+    }
+  }
+  if (it->rows_received < image.height)
+    return sensor_msgs::ImagePtr();
+
+  sensor_msgs::ImagePtr complete = it->image;
+  // anything older than a completed frame will not be completed any more
+  dropped_ += it - pending_.begin();
+  done_stamp_ = std::max(done_stamp_, complete->header.stamp);
+  pending_.erase(pending_.begin(), it + 1);
+  return complete;
+}
+
+uint64_t StripAssembler::dropped() const
+{
+  return dropped_;
+}
+
+}  // namespace rviz_camera_stream
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "rviz_camera_stream/frame_cache.h"
+
+using rviz_camera_stream::FrameCache;
+
+namespace
+{
+
+void add(FrameCache& cache, double stamp, uint32_t seq = 0)
+{
+  sensor_msgs::ImagePtr image(new sensor_msgs::Image);
+  image->header.stamp = ros::Time(stamp);
+  image->header.seq = seq;
+  sensor_msgs::CameraInfoPtr camera_info(new sensor_msgs::CameraInfo);
+  camera_info->header = image->header;
+  cache.add(image, camera_info);
+}
+
+double stamp(const FrameCache::Frame& frame)
+{
+  return frame.image->header.stamp.toSec();
+}
+
+// Frames at 10, 11, ... 10 + count - 1
+void fill(FrameCache& cache, size_t count)
+{
+  cache.setLimits(100, 0.0);
+  for (size_t i = 0; i < count; ++i)
+  {
+    add(cache, 10.0 + i, i);
+  }
+}
+
+}  // namespace
+
+TEST(FrameCache, Empty)
+{
+  FrameCache cache;
+  cache.setLimits(10, 0.0);
+  FrameCache::Frame frame;
+  FrameCache::Frame next;
+  EXPECT_FALSE(cache.nearest(ros::Time(1.0), frame));
+  EXPECT_FALSE(cache.nearest(ros::Time(), frame));
+  EXPECT_FALSE(cache.bracket(ros::Time(1.0), frame, next));
+  ros::Time oldest;
+  ros::Time newest;
+  EXPECT_FALSE(cache.span(oldest, newest));
+}
+
+TEST(FrameCache, NoneKeptWithoutLimit)
+{
+  FrameCache cache;
+  add(cache, 10.0);
+  EXPECT_EQ(0u, cache.size());
+}
+
+TEST(FrameCache, NearestEdges)
+{
+  FrameCache cache;
+  fill(cache, 3);
+  FrameCache::Frame frame;
+  ASSERT_TRUE(cache.nearest(ros::Time(1.0), frame));
+  EXPECT_EQ(10.0, stamp(frame));
+  ASSERT_TRUE(cache.nearest(ros::Time(100.0), frame));
+  EXPECT_EQ(12.0, stamp(frame));
+  ASSERT_TRUE(cache.nearest(ros::Time(10.0), frame));
+  EXPECT_EQ(10.0, stamp(frame));
+  ASSERT_TRUE(cache.nearest(ros::Time(12.0), frame));
+  EXPECT_EQ(12.0, stamp(frame));
+  // a zero stamp asks for the newest frame
+  ASSERT_TRUE(cache.nearest(ros::Time(), frame));
+  EXPECT_EQ(12.0, stamp(frame));
+}
+
+TEST(FrameCache, NearestBetween)
+{
+  FrameCache cache;
+  fill(cache, 3);
+  FrameCache::Frame frame;
+  ASSERT_TRUE(cache.nearest(ros::Time(10.25), frame));
+  EXPECT_EQ(10.0, stamp(frame));
+  ASSERT_TRUE(cache.nearest(ros::Time(10.75), frame));
+  EXPECT_EQ(11.0, stamp(frame));
+  // halfway the earlier frame wins
+  ASSERT_TRUE(cache.nearest(ros::Time(11.5), frame));
+  EXPECT_EQ(11.0, stamp(frame));
+}
+
+TEST(FrameCache, BracketEdges)
+{
+  FrameCache cache;
+  fill(cache, 3);
+  FrameCache::Frame before;
+  FrameCache::Frame after;
+  EXPECT_FALSE(cache.bracket(ros::Time(9.5), before, after));
+  EXPECT_FALSE(cache.bracket(ros::Time(12.5), before, after));
+  ASSERT_TRUE(cache.bracket(ros::Time(10.0), before, after));
+  EXPECT_EQ(10.0, stamp(before));
+  EXPECT_EQ(10.0, stamp(after));
+  ASSERT_TRUE(cache.bracket(ros::Time(12.0), before, after));
+  EXPECT_EQ(12.0, stamp(before));
+  EXPECT_EQ(12.0, stamp(after));
+}
+
+TEST(FrameCache, BracketBetween)
+{
+  FrameCache cache;
+  fill(cache, 3);
+  FrameCache::Frame before;
+  FrameCache::Frame after;
+  ASSERT_TRUE(cache.bracket(ros::Time(11.25), before, after));
+  EXPECT_EQ(11.0, stamp(before));
+  EXPECT_EQ(12.0, stamp(after));
+  ASSERT_TRUE(cache.bracket(ros::Time(11.0), before, after));
+  EXPECT_EQ(11.0, stamp(before));
+  EXPECT_EQ(11.0, stamp(after));
+}
+
+TEST(FrameCache, EqualStamps)
+{
+  FrameCache cache;
+  cache.setLimits(10, 0.0);
+  add(cache, 10.0, 0);
+  add(cache, 11.0, 1);
+  add(cache, 11.0, 2);
+  add(cache, 12.0, 3);
+  // a repeated stamp does not count as going back
+  EXPECT_EQ(4u, cache.size());
+
+  FrameCache::Frame frame;
+  ASSERT_TRUE(cache.nearest(ros::Time(11.0), frame));
+  EXPECT_EQ(11.0, stamp(frame));
+  FrameCache::Frame before;
+  FrameCache::Frame after;
+  ASSERT_TRUE(cache.bracket(ros::Time(11.0), before, after));
+  EXPECT_EQ(11.0, stamp(before));
+  EXPECT_EQ(11.0, stamp(after));
+  ASSERT_TRUE(cache.bracket(ros::Time(11.5), before, after));
+  EXPECT_EQ(2u, before.image->header.seq);
+  EXPECT_EQ(3u, after.image->header.seq);
+  ASSERT_TRUE(cache.bracket(ros::Time(10.5), before, after));
+  EXPECT_EQ(0u, before.image->header.seq);
+  EXPECT_EQ(1u, after.image->header.seq);
+}
+
+TEST(FrameCache, StampGoingBackResets)
+{
+  FrameCache cache;
+  fill(cache, 3);
+  add(cache, 5.0);
+  EXPECT_EQ(1u, cache.size());
+  ros::Time oldest;
+  ros::Time newest;
+  ASSERT_TRUE(cache.span(oldest, newest));
+  EXPECT_EQ(5.0, oldest.toSec());
+  EXPECT_EQ(5.0, newest.toSec());
+  FrameCache::Frame frame;
+  ASSERT_TRUE(cache.nearest(ros::Time(11.0), frame));
+  EXPECT_EQ(5.0, stamp(frame));
+}
+
+TEST(FrameCache, Limits)
+{
+  FrameCache cache;
+  cache.setLimits(3, 0.0);
+  for (int i = 0; i < 5; ++i)
+  {
+    add(cache, 10.0 + i);
+  }
+  ros::Time oldest;
+  ros::Time newest;
+  ASSERT_TRUE(cache.span(oldest, newest));
+  EXPECT_EQ(3u, cache.size());
+  EXPECT_EQ(12.0, oldest.toSec());
+  EXPECT_EQ(14.0, newest.toSec());
+
+  cache.setLimits(10, 1.5);
+  ASSERT_TRUE(cache.span(oldest, newest));
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_EQ(13.0, oldest.toSec());
+
+  cache.setLimits(0, 0.0);
+  EXPECT_EQ(0u, cache.size());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "rviz_camera_stream/multicast_image.h"
+
+using rviz_camera_stream::MulticastFragmentHeader;
+using rviz_camera_stream::MulticastImageReceiver;
+using rviz_camera_stream::MulticastImageSender;
+
+namespace
+{
+
+const size_t FRAGMENT_SIZE = 100;
+const size_t FEC_GROUP = 4;
+
+// Keeps the datagrams instead of sending them, so the tests decide which get lost
+class CapturingSender : public MulticastImageSender
+{
+public:
+  std::vector<std::vector<uint8_t> > datagrams;
+
+protected:
+  virtual bool sendDatagram(iovec* iov, size_t count)
+  {
+    std::vector<uint8_t> datagram;
+    for (size_t i = 0; i < count; ++i)
+    {
+      const uint8_t* data = static_cast<const uint8_t*>(iov[i].iov_base);
+      datagram.insert(datagram.end(), data, data + iov[i].iov_len);
+    }
+    datagrams.push_back(datagram);
+    return true;
+  }
+};
+
+MulticastFragmentHeader header(const std::vector<uint8_t>& datagram)
+{
+  MulticastFragmentHeader header;
+  memcpy(&header, &datagram[0], sizeof(header));
+  return header;
+}
+
+uint16_t index(const std::vector<uint8_t>& datagram)
+{
+  return ntohs(header(datagram).index);
+}
+
+uint16_t dataCount(const std::vector<uint8_t>& datagram)
+{
+  return ntohs(header(datagram).data_count);
+}
+
+sensor_msgs::Image makeImage(uint32_t width, uint32_t height)
+{
+  sensor_msgs::Image image;
+  image.header.frame_id = "camera";
+  image.encoding = "mono8";
+  image.width = width;
+  image.height = height;
+  image.step = width;
+  image.data.resize(width * height);
+  for (size_t i = 0; i < image.data.size(); ++i)
+  {
+    image.data[i] = i * 7 + 3;
+  }
+  return image;
+}
+
+class MulticastImageTest : public testing::Test
+{
+protected:
+  CapturingSender sender;
+  MulticastImageReceiver receiver;
+  sensor_msgs::Image image;
+
+  virtual void SetUp()
+  {
+    // the socket is only needed for send() to run, nothing goes out on it
+    std::string error;
+    ASSERT_TRUE(sender.open("239.255.0.1", 5004, 0, "", error)) << error;
+    sender.setFragmentSize(FRAGMENT_SIZE);
+    sender.setFecGroup(FEC_GROUP);
+    // 851 bytes of pixels leave the last group short and its last fragment shorter
+    image = makeImage(37, 23);
+  }
+
+  // Feeds every captured datagram but the ones with the given indices
+  bool deliver(const std::vector<uint16_t>& lost, sensor_msgs::Image& out)
+  {
+    bool complete = false;
+    for (size_t i = 0; i < sender.datagrams.size(); ++i)
+    {
+      const std::vector<uint8_t>& datagram = sender.datagrams[i];
+      if (std::find(lost.begin(), lost.end(), index(datagram)) != lost.end())
+        continue;
+      complete = receiver.addDatagram(&datagram[0], datagram.size(), out) || complete;
+    }
+    return complete;
+  }
+
+  void expectImage(const sensor_msgs::Image& out)
+  {
+    EXPECT_EQ(image.header.frame_id, out.header.frame_id);
+    EXPECT_EQ(image.encoding, out.encoding);
+    EXPECT_EQ(image.width, out.width);
+    EXPECT_EQ(image.height, out.height);
+    EXPECT_EQ(image.step, out.step);
+    EXPECT_TRUE(image.data == out.data);
+  }
+};
+
+}  // namespace
+
+TEST_F(MulticastImageTest, FragmentsAndParity)
+{
+  ASSERT_TRUE(sender.send(image));
+  const uint16_t data_count = dataCount(sender.datagrams.front());
+  const size_t parity_count = (data_count + FEC_GROUP - 1) / FEC_GROUP;
+  ASSERT_GT(data_count % FEC_GROUP, 0u);
+  EXPECT_EQ(data_count + parity_count, sender.datagrams.size());
+
+  for (size_t i = 0; i < sender.datagrams.size(); ++i)
+  {
+    const std::vector<uint8_t>& datagram = sender.datagrams[i];
+    const uint16_t fragment = index(datagram);
+    const size_t payload = datagram.size() - sizeof(MulticastFragmentHeader);
+    if (fragment + 1 < data_count)
+    {
+      EXPECT_EQ(FRAGMENT_SIZE, payload);
+    }
+    else if (fragment + 1 == data_count)
+    {
+      EXPECT_LT(payload, FRAGMENT_SIZE);
+      EXPECT_GT(payload, 0u);
+    }
+    else
+    {
+      // parity is always a full fragment
+      EXPECT_EQ(FRAGMENT_SIZE, payload);
+    }
+  }
+}
+
+TEST_F(MulticastImageTest, NoLoss)
+{
+  ASSERT_TRUE(sender.send(image));
+  sensor_msgs::Image out;
+  ASSERT_TRUE(deliver(std::vector<uint16_t>(), out));
+  expectImage(out);
+  EXPECT_EQ(0u, receiver.recovered());
+  EXPECT_EQ(0u, receiver.dropped());
+}
+
+TEST_F(MulticastImageTest, LostDataFragment)
+{
+  ASSERT_TRUE(sender.send(image));
+  sensor_msgs::Image out;
+  ASSERT_TRUE(deliver(std::vector<uint16_t>(1, 1), out));
+  expectImage(out);
+  EXPECT_EQ(1u, receiver.recovered());
+}
+
+TEST_F(MulticastImageTest, LostParityFragment)
+{
+  ASSERT_TRUE(sender.send(image));
+  const uint16_t data_count = dataCount(sender.datagrams.front());
+  sensor_msgs::Image out;
+  ASSERT_TRUE(deliver(std::vector<uint16_t>(1, data_count), out));
+  expectImage(out);
+  EXPECT_EQ(0u, receiver.recovered());
+}
+
+TEST_F(MulticastImageTest, LostShortLastFragment)
+{
+  ASSERT_TRUE(sender.send(image));
+  const uint16_t data_count = dataCount(sender.datagrams.front());
+  sensor_msgs::Image out;
+  ASSERT_TRUE(deliver(std::vector<uint16_t>(1, data_count - 1), out));
+  expectImage(out);
+  EXPECT_EQ(1u, receiver.recovered());
+}
+
+TEST_F(MulticastImageTest, TwoLostInOneGroup)
+{
+  ASSERT_TRUE(sender.send(image));
+  std::vector<uint16_t> lost;
+  lost.push_back(0);
+  lost.push_back(1);
+  sensor_msgs::Image out;
+  EXPECT_FALSE(deliver(lost, out));
+  EXPECT_EQ(0u, receiver.recovered());
+}
+
+TEST_F(MulticastImageTest, OneLostInEveryGroup)
+{
+  ASSERT_TRUE(sender.send(image));
+  const uint16_t data_count = dataCount(sender.datagrams.front());
+  std::vector<uint16_t> lost;
+  for (uint16_t i = 0; i < data_count; i += FEC_GROUP)
+  {
+    lost.push_back(i);
+  }
+  sensor_msgs::Image out;
+  ASSERT_TRUE(deliver(lost, out));
+  expectImage(out);
+  EXPECT_EQ(lost.size(), receiver.recovered());
+}
+
+TEST_F(MulticastImageTest, WithoutParity)
+{
+  sender.setFecGroup(0);
+  ASSERT_TRUE(sender.send(image));
+  EXPECT_EQ(dataCount(sender.datagrams.front()), sender.datagrams.size());
+  sensor_msgs::Image out;
+  ASSERT_TRUE(deliver(std::vector<uint16_t>(), out));
+  expectImage(out);
+}
+
+TEST_F(MulticastImageTest, OversizedFrame)
+{
+  sender.setFragmentSize(1);
+  image = makeImage(256, 256);
+  EXPECT_FALSE(sender.send(image));
+  EXPECT_TRUE(sender.datagrams.empty());
+  EXPECT_EQ(1u, sender.oversized());
+}
+
+// A second sender on the same group and port numbers its frames the same way
+TEST_F(MulticastImageTest, MismatchedHeaderDropped)
+{
+  CapturingSender other;
+  std::string error;
+  ASSERT_TRUE(other.open("239.255.0.1", 5004, 0, "", error)) << error;
+  other.setFragmentSize(FRAGMENT_SIZE / 2);
+  other.setFecGroup(FEC_GROUP);
+  ASSERT_TRUE(other.send(makeImage(61, 17)));
+  ASSERT_TRUE(sender.send(image));
+
+  const size_t half = sender.datagrams.size() / 2;
+  bool complete = false;
+  sensor_msgs::Image out;
+  for (size_t i = 0; i < half; ++i)
+  {
+    complete = receiver.addDatagram(&sender.datagrams[i][0], sender.datagrams[i].size(), out) || complete;
+  }
+  for (size_t i = 0; i < other.datagrams.size(); ++i)
+  {
+    EXPECT_FALSE(receiver.addDatagram(&other.datagrams[i][0], other.datagrams[i].size(), out));
+  }
+  for (size_t i = half; i < sender.datagrams.size(); ++i)
+  {
+    complete = receiver.addDatagram(&sender.datagrams[i][0], sender.datagrams[i].size(), out) || complete;
+  }
+  ASSERT_TRUE(complete);
+  expectImage(out);
+}
+
+TEST_F(MulticastImageTest, ForgedHeaderDropped)
+{
+  ASSERT_TRUE(sender.send(image));
+  sensor_msgs::Image out;
+  const std::vector<uint8_t>& first = sender.datagrams.front();
+  EXPECT_FALSE(receiver.addDatagram(&first[0], first.size(), out));
+
+  // consistent in itself but not with the frame the first datagram started
+  std::vector<uint8_t> forged = sender.datagrams[1];
+  MulticastFragmentHeader fields = header(forged);
+  fields.frame_size = htonl(ntohl(fields.frame_size) * 4);
+  fields.data_count = htons(ntohs(fields.data_count) * 4);
+  memcpy(&forged[0], &fields, sizeof(fields));
+  EXPECT_FALSE(receiver.addDatagram(&forged[0], forged.size(), out));
+
+  std::vector<uint16_t> lost(1, 0);
+  ASSERT_TRUE(deliver(lost, out));
+  expectImage(out);
+  EXPECT_EQ(0u, receiver.recovered());
+}
+
+TEST_F(MulticastImageTest, FrameSizeLimit)
+{
+  MulticastImageReceiver small(4, 1000);
+  ASSERT_TRUE(sender.send(makeImage(40, 40)));
+  sensor_msgs::Image out;
+  for (size_t i = 0; i < sender.datagrams.size(); ++i)
+  {
+    EXPECT_FALSE(small.addDatagram(&sender.datagrams[i][0], sender.datagrams[i].size(), out));
+  }
+
+  // a single datagram announcing a huge frame is not allocated for
+  std::vector<uint8_t> forged(sizeof(MulticastFragmentHeader) + FRAGMENT_SIZE);
+  MulticastFragmentHeader fields = header(sender.datagrams.front());
+  fields.frame_size = htonl(0xffffffff);
+  fields.fragment_size = htons(0xffff);
+  fields.data_count = htons(0xffff);
+  memcpy(&forged[0], &fields, sizeof(fields));
+  EXPECT_FALSE(receiver.addDatagram(&forged[0], forged.size(), out));
+}
+
+TEST_F(MulticastImageTest, SenderRestart)
+{
+  sensor_msgs::Image out;
+  for (int i = 0; i < 10; ++i)
+  {
+    sender.datagrams.clear();
+    ASSERT_TRUE(sender.send(image));
+    ASSERT_TRUE(deliver(std::vector<uint16_t>(), out));
+  }
+
+  // counts from 1 again
+  CapturingSender restarted;
+  std::string error;
+  ASSERT_TRUE(restarted.open("239.255.0.1", 5004, 0, "", error)) << error;
+  restarted.setFragmentSize(FRAGMENT_SIZE);
+  restarted.setFecGroup(FEC_GROUP);
+  image = makeImage(20, 10);
+  ASSERT_TRUE(restarted.send(image));
+  bool complete = false;
+  for (size_t i = 0; i < restarted.datagrams.size(); ++i)
+  {
+    complete = receiver.addDatagram(&restarted.datagrams[i][0], restarted.datagrams[i].size(), out) || complete;
+  }
+  ASSERT_TRUE(complete);
+  expectImage(out);
+
+  // the frame it just completed is not taken again
+  EXPECT_FALSE(receiver.addDatagram(&restarted.datagrams[0][0], restarted.datagrams[0].size(), out));
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
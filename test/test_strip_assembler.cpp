@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2012, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "rviz_camera_stream/strip_assembler.h"
+
+using rviz_camera_stream::StripAssembler;
+
+namespace
+{
+
+const uint32_t WIDTH = 4;
+const uint32_t HEIGHT = 10;
+
+// The rows of a frame filled with the row number plus seed
+sensor_msgs::Image makeFrame(uint32_t width, uint32_t height, uint8_t seed)
+{
+  sensor_msgs::Image frame;
+  frame.encoding = "mono8";
+  frame.width = width;
+  frame.height = height;
+  frame.step = width;
+  frame.data.resize(width * height);
+  for (uint32_t y = 0; y < height; ++y)
+  {
+    std::fill(frame.data.begin() + y * width, frame.data.begin() + (y + 1) * width, seed + y);
+  }
+  return frame;
+}
+
+struct Strip
+{
+  sensor_msgs::ImageConstPtr image;
+  sensor_msgs::CameraInfoConstPtr info;
+};
+
+// Cut a frame into strips the way CameraPub publishes them
+std::vector<Strip> makeStrips(const sensor_msgs::Image& frame, uint32_t strip_rows, double stamp)
+{
+  std::vector<Strip> strips;
+  for (uint32_t y0 = 0; y0 < frame.height; y0 += strip_rows)
+  {
+    const uint32_t rows = std::min(strip_rows, frame.height - y0);
+    sensor_msgs::ImagePtr image(new sensor_msgs::Image);
+    image->header.stamp = ros::Time(stamp);
+    image->encoding = frame.encoding;
+    image->width = frame.width;
+    image->height = rows;
+    image->step = frame.step;
+    image->data.assign(frame.data.begin() + y0 * frame.step, frame.data.begin() + (y0 + rows) * frame.step);
+    sensor_msgs::CameraInfoPtr info(new sensor_msgs::CameraInfo);
+    info->header.stamp = image->header.stamp;
+    info->width = frame.width;
+    info->height = frame.height;
+    info->roi.y_offset = y0;
+    info->roi.width = frame.width;
+    info->roi.height = rows;
+    Strip strip;
+    strip.image = image;
+    strip.info = info;
+    strips.push_back(strip);
+  }
+  return strips;
+}
+
+}  // namespace
+
+TEST(StripAssembler, InOrder)
+{
+  StripAssembler assembler;
+  const sensor_msgs::Image frame = makeFrame(WIDTH, HEIGHT, 0);
+  const std::vector<Strip> strips = makeStrips(frame, 3, 1.0);
+  ASSERT_EQ(4u, strips.size());
+  for (size_t i = 0; i + 1 < strips.size(); ++i)
+  {
+    EXPECT_FALSE(assembler.add(strips[i].image, strips[i].info));
+  }
+  sensor_msgs::ImagePtr complete = assembler.add(strips.back().image, strips.back().info);
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(frame.data, complete->data);
+  EXPECT_EQ(HEIGHT, complete->height);
+  EXPECT_EQ(ros::Time(1.0), complete->header.stamp);
+  EXPECT_EQ(0u, assembler.dropped());
+}
+
+TEST(StripAssembler, OutOfOrder)
+{
+  StripAssembler assembler;
+  const sensor_msgs::Image frame = makeFrame(WIDTH, HEIGHT, 5);
+  std::vector<Strip> strips = makeStrips(frame, 3, 1.0);
+  std::reverse(strips.begin(), strips.end());
+  std::swap(strips[1], strips[2]);
+  sensor_msgs::ImagePtr complete;
+  for (size_t i = 0; i < strips.size(); ++i)
+  {
+    EXPECT_FALSE(complete);
+    complete = assembler.add(strips[i].image, strips[i].info);
+  }
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(frame.data, complete->data);
+}
+
+TEST(StripAssembler, InterleavedFrames)
+{
+  StripAssembler assembler;
+  const sensor_msgs::Image first = makeFrame(WIDTH, HEIGHT, 0);
+  const sensor_msgs::Image second = makeFrame(WIDTH, HEIGHT, 100);
+  const std::vector<Strip> a = makeStrips(first, 5, 1.0);
+  const std::vector<Strip> b = makeStrips(second, 5, 2.0);
+  EXPECT_FALSE(assembler.add(a[0].image, a[0].info));
+  EXPECT_FALSE(assembler.add(b[0].image, b[0].info));
+  sensor_msgs::ImagePtr complete = assembler.add(a[1].image, a[1].info);
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(first.data, complete->data);
+  complete = assembler.add(b[1].image, b[1].info);
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(second.data, complete->data);
+  EXPECT_EQ(0u, assembler.dropped());
+}
+
+TEST(StripAssembler, MissingStrip)
+{
+  StripAssembler assembler(2);
+  const sensor_msgs::Image frame = makeFrame(WIDTH, HEIGHT, 0);
+  const std::vector<Strip> incomplete = makeStrips(frame, 3, 1.0);
+  for (size_t i = 0; i < incomplete.size(); ++i)
+  {
+    if (i != 1)
+    {
+      EXPECT_FALSE(assembler.add(incomplete[i].image, incomplete[i].info));
+    }
+  }
+
+  // the next frame completes, the one missing a strip is given up on
+  const std::vector<Strip> strips = makeStrips(frame, 3, 2.0);
+  sensor_msgs::ImagePtr complete;
+  for (size_t i = 0; i < strips.size(); ++i)
+  {
+    complete = assembler.add(strips[i].image, strips[i].info);
+  }
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(ros::Time(2.0), complete->header.stamp);
+  EXPECT_EQ(1u, assembler.dropped());
+
+  // the late strip belongs to a frame that was dropped and does not start it again
+  EXPECT_FALSE(assembler.add(incomplete[1].image, incomplete[1].info));
+  for (int frame_index = 0; frame_index < 3; ++frame_index)
+  {
+    const std::vector<Strip> next = makeStrips(frame, 3, 3.0 + frame_index);
+    for (size_t i = 0; i < next.size(); ++i)
+    {
+      complete = assembler.add(next[i].image, next[i].info);
+    }
+    EXPECT_TRUE(complete);
+  }
+  EXPECT_EQ(1u, assembler.dropped());
+}
+
+TEST(StripAssembler, TimeGoesBack)
+{
+  StripAssembler assembler;
+  const sensor_msgs::Image frame = makeFrame(WIDTH, HEIGHT, 0);
+  for (double stamp = 100.0; stamp > 0.0; stamp -= 99.0)
+  {
+    const std::vector<Strip> strips = makeStrips(frame, 5, stamp);
+    EXPECT_FALSE(assembler.add(strips[0].image, strips[0].info));
+    EXPECT_TRUE(assembler.add(strips[1].image, strips[1].info));
+  }
+}
+
+TEST(StripAssembler, TooManyPending)
+{
+  StripAssembler assembler(2);
+  const sensor_msgs::Image frame = makeFrame(WIDTH, HEIGHT, 0);
+  for (int i = 0; i < 3; ++i)
+  {
+    const std::vector<Strip> strips = makeStrips(frame, 5, 1.0 + i);
+    EXPECT_FALSE(assembler.add(strips[0].image, strips[0].info));
+  }
+  EXPECT_EQ(1u, assembler.dropped());
+}
+
+TEST(StripAssembler, SizeChange)
+{
+  StripAssembler assembler;
+  const sensor_msgs::Image small = makeFrame(WIDTH, HEIGHT, 0);
+  const sensor_msgs::Image large = makeFrame(2 * WIDTH, 2 * HEIGHT, 50);
+  const std::vector<Strip> a = makeStrips(small, 4, 1.0);
+  const std::vector<Strip> b = makeStrips(large, 4, 2.0);
+
+  sensor_msgs::ImagePtr complete;
+  for (size_t i = 0; i < a.size(); ++i)
+  {
+    complete = assembler.add(a[i].image, a[i].info);
+  }
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(small.data, complete->data);
+
+  for (size_t i = 0; i < b.size(); ++i)
+  {
+    complete = assembler.add(b[i].image, b[i].info);
+  }
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(2 * WIDTH, complete->width);
+  EXPECT_EQ(2 * HEIGHT, complete->height);
+  EXPECT_EQ(large.data, complete->data);
+}
+
+TEST(StripAssembler, StripOutsideFrame)
+{
+  StripAssembler assembler;
+  const sensor_msgs::Image frame = makeFrame(WIDTH, HEIGHT, 0);
+  std::vector<Strip> strips = makeStrips(frame, 4, 1.0);
+  sensor_msgs::CameraInfoPtr info(new sensor_msgs::CameraInfo(*strips.back().info));
+  info->roi.y_offset = HEIGHT - 1;
+  EXPECT_FALSE(assembler.add(strips.back().image, info));
+  sensor_msgs::ImagePtr wide(new sensor_msgs::Image(*strips.front().image));
+  wide->width = 2 * WIDTH;
+  EXPECT_FALSE(assembler.add(wide, strips.front().info));
+  EXPECT_EQ(0u, assembler.dropped());
+}
+
+TEST(StripAssembler, DuplicateStrip)
+{
+  StripAssembler assembler;
+  const sensor_msgs::Image frame = makeFrame(WIDTH, HEIGHT, 0);
+  const std::vector<Strip> strips = makeStrips(frame, 3, 1.0);
+  ASSERT_EQ(4u, strips.size());
+  EXPECT_FALSE(assembler.add(strips[0].image, strips[0].info));
+  EXPECT_FALSE(assembler.add(strips[1].image, strips[1].info));
+  EXPECT_FALSE(assembler.add(strips[1].image, strips[1].info));
+  // counting rows the repeated strip would complete the frame here
+  EXPECT_FALSE(assembler.add(strips[2].image, strips[2].info));
+  sensor_msgs::ImagePtr complete = assembler.add(strips[3].image, strips[3].info);
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(frame.data, complete->data);
+}
+
+TEST(StripAssembler, MalformedStrip)
+{
+  StripAssembler assembler;
+  const sensor_msgs::Image frame = makeFrame(WIDTH, HEIGHT, 0);
+  const std::vector<Strip> strips = makeStrips(frame, 3, 1.0);
+  sensor_msgs::ImagePtr short_data(new sensor_msgs::Image(*strips[0].image));
+  short_data->data.resize(short_data->data.size() - 1);
+  EXPECT_FALSE(assembler.add(short_data, strips[0].info));
+  sensor_msgs::ImagePtr long_step(new sensor_msgs::Image(*strips[0].image));
+  long_step->step = 2 * WIDTH;
+  EXPECT_FALSE(assembler.add(long_step, strips[0].info));
+  sensor_msgs::ImagePtr no_step(new sensor_msgs::Image(*strips[0].image));
+  no_step->step = 0;
+  EXPECT_FALSE(assembler.add(no_step, strips[0].info));
+
+  // a strip with another step than the frame it belongs to
+  EXPECT_FALSE(assembler.add(strips[0].image, strips[0].info));
+  sensor_msgs::ImagePtr other_step(new sensor_msgs::Image(*strips[1].image));
+  other_step->step = 2 * WIDTH;
+  other_step->data.resize(other_step->height * other_step->step);
+  EXPECT_FALSE(assembler.add(other_step, strips[1].info));
+
+  for (size_t i = 1; i + 1 < strips.size(); ++i)
+  {
+    EXPECT_FALSE(assembler.add(strips[i].image, strips[i].info));
+  }
+  sensor_msgs::ImagePtr complete = assembler.add(strips.back().image, strips.back().info);
+  ASSERT_TRUE(complete);
+  EXPECT_EQ(frame.data, complete->data);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}